@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+package com.thejustinwalsh.net
+{
+	// Classes for Socket.sendPriority, each socket queues every class separately so urgent messages do not wait behind bulk ones.
+	// Classes only switch between messages, and a message only ends on flush(). Data sent by automatic flushes stays one
+	// open message, and once it starts going out every class waits for it, control included, until flush() is called.
+	public final class SendPriority
+	{
+		// Small urgent messages, input acknowledgements and the like
+		public static const CONTROL:int = 0;
+		
+		// Everything that does not ask for a class
+		public static const NORMAL:int = 1;
+		
+		// Snapshots and asset chunks, limited in how much may wait in the kernel at once
+		public static const BULK:int = 2;
+	}
+}
@@ -23,7 +23,9 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 package com.thejustinwalsh.net
 {
+	import flash.events.ServerSocketConnectEvent;
 	import flash.net.ServerSocket;
+	import flash.utils.ByteArray;
 
 	public class ServerSocket extends flash.net.ServerSocket
 	{
@@ -31,5 +33,66 @@ package com.thejustinwalsh.net
 		{
 			super();
 		}
+		
+		// Extra listeners are separate servers that forward their connections through this one
+		public function addListener(localPort:int = 0, localAddress:String = "0.0.0.0", backlog:int = 0, options:Object = null):int
+		{
+			var listener:flash.net.ServerSocket = new flash.net.ServerSocket();
+			listener.bind(localPort, localAddress);
+			listener.addEventListener(ServerSocketConnectEvent.CONNECT, dispatchEvent);
+			listener.listen(backlog);
+			_listeners[listener.localPort] = listener;
+			return listener.localPort;
+		}
+		
+		public function removeListener(localPort:int):void
+		{
+			var listener:flash.net.ServerSocket = _listeners[localPort];
+			if (listener == null) return;
+			listener.close();
+			delete _listeners[localPort];
+		}
+		
+		override public function close():void
+		{
+			for each (var listener:flash.net.ServerSocket in _listeners) {
+				listener.close();
+			}
+			_listeners = {};
+			super.close();
+		}
+		
+		// Low latency options and IO thread stats are only available with the native implementation
+		public function listenWithOptions(backlog:int, options:Object):void { listen(backlog); }
+		public function reactorStats(reset:Boolean = false):Object { return {}; }
+		
+		// Outbound connections fall back to a regular socket, pooling is only available with the native implementation
+		public function connect(host:String, port:int):Socket { return new Socket(host, port); }
+		public function configureConnectionPool(maxIdlePerDestination:int, idleTimeout:int = 30000):void { }
+		
+		// Admission limits are only available with the native implementation
+		public function setAdmissionLimits(connectionsPerSecondPerAddress:Number = 0, burstPerAddress:int = 0, connectionsPerSecond:Number = 0, burst:int = 0):void { }
+		
+		// HTTP parsing and the response cache are only available with the native implementation
+		public function setHttpCache(path:String, response:ByteArray):Boolean { return false; }
+		public function clearHttpCache(path:String):void { }
+		
+		// Send scheduling is only available with the native implementation
+		public function setSendScheduling(strict:Boolean = false, controlWeight:int = 8, normalWeight:int = 4, bulkWeight:int = 1, bulkInFlight:int = 65536):void { }
+		
+		// Memory budgets are only available with the native implementation
+		public function setMemoryBudget(bytes:Number, idleTimeout:int = 5000):void { }
+		public function memoryUsage():Object { return {}; }
+		
+		// Traffic capture is only available with the native implementation
+		public function startCapture(path:String, size:int = 8388608):void { }
+		public function stopCapture():void { }
+		
+		// Latency tracing is only available with the native implementation
+		public function startTrace():void { }
+		public function stopTrace():void { }
+		public function traceStats(reset:Boolean = false):Object { return {}; }
+		
+		private var _listeners:Object = {};
 	}
 }
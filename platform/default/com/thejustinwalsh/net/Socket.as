@@ -31,5 +31,13 @@ package com.thejustinwalsh.net
 		{
 			super(host, port);
 		}
+		
+		// Connection pooling is only available with the native implementation
+		public var keepAlive:Boolean = false;
+		public static function configureConnectionPool(maxIdlePerDestination:int, idleTimeout:int = 30000):void { }
+		
+		// Send priorities are only available with the native implementation
+		public var sendPriority:int = SendPriority.NORMAL;
+		public static function configureSendScheduling(strict:Boolean = false, controlWeight:int = 8, normalWeight:int = 4, bulkWeight:int = 1, bulkInFlight:int = 65536):void { }
 	}
 }
@@ -24,14 +24,36 @@
 #include "ServerSocket.h"
 
 #define READ_LENGTH 512
+#define ACCEPT_BUDGET 64
+#define ACCEPT_BACKOFF_NS 250000000ULL
+#define SEND_THROTTLE_USEC 1000
+#define HTTP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_TOO_LARGE "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_LINGER_NS 2000000000ULL
+#define HTTP_HEAD_TIMEOUT_NS 30000000000ULL
 
 context_data* context_data_alloc()
 {
+  int i = 0;
+  
   // Allocate our context struct
   context_data* ctxdata = malloc(sizeof(context_data));
   
-  // Initialize our sockets array
-  memset(&ctxdata->sockets, 0, sizeof(ctxdata->sockets));
+  // Initialize our state and sockets array
+  memset(ctxdata, 0, sizeof(context_data));
+  ctxdata->reserve_fd = -1;
+  for (i = 0; i < SS_MAX_LISTENERS; ++i) {
+    ctxdata->listeners[i].socket_fd = -1;
+  }
+  
+  // Start without any admission limits, memory budget or connection pool
+  ss_admission_init(&ctxdata->admission);
+  ss_budget_init(&ctxdata->budget);
+  ss_pool_init(&ctxdata->pool);
+  ss_send_policy_init(&ctxdata->send_policy);
+  ss_http_cache_init(&ctxdata->http_cache);
+  pthread_mutex_init(&ctxdata->sockets_lock, NULL);
   
   // Hand back the context data
   return ctxdata;
@@ -39,9 +61,41 @@ context_data* context_data_alloc()
 
 void context_data_free(context_data* ctxdata)
 {
+  ss_admission_destroy(&ctxdata->admission);
+  ss_pool_destroy(&ctxdata->pool);
+  ss_http_cache_destroy(&ctxdata->http_cache);
+  pthread_mutex_destroy(&ctxdata->sockets_lock);
   free(ctxdata);
 }
 
+reactor_data* reactor_data_alloc()
+{
+  // Allocate our reactor struct
+  reactor_data* reactor = malloc(sizeof(reactor_data));
+  memset(reactor, 0, sizeof(reactor_data));
+  pthread_mutex_init(&reactor->lock, NULL);
+  pthread_cond_init(&reactor->closed, NULL);
+  
+  // Create the non-blocking pipe the AS layer uses to wake the reactor
+  reactor->wake_fds[0] = reactor->wake_fds[1] = -1;
+  if (pipe(reactor->wake_fds) == 0) {
+    fcntl(reactor->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(reactor->wake_fds[1], F_SETFL, O_NONBLOCK);
+  }
+  
+  // Hand back the reactor data
+  return reactor;
+}
+
+void reactor_data_free(reactor_data* reactor)
+{
+  pthread_mutex_destroy(&reactor->lock);
+  pthread_cond_destroy(&reactor->closed);
+  if (reactor->wake_fds[0] >= 0) close(reactor->wake_fds[0]);
+  if (reactor->wake_fds[1] >= 0) close(reactor->wake_fds[1]);
+  free(reactor);
+}
+
 void generate_error(FREObject* object)
 {
   FRENewObject((const uint8_t*)"Object", 0, NULL, object, NULL);
@@ -56,322 +110,1624 @@ void generate_error(FREObject* object)
   FRESetObjectProperty(*object, (const uint8_t*)"error", fre_error, NULL);
 }
 
-void* serverListeningThread(void *pArg)
+/* set_number_property - Set a numeric property on an AS object
+ */
+static void set_number_property(FREObject object, const char* name, double value)
+{
+  FREObject fre_value;
+  FRENewObjectFromDouble(value, &fre_value);
+  FRESetObjectProperty(object, (const uint8_t*)name, fre_value, NULL);
+}
+
+/* refuse_connection - Close a connection we will not serve with a reset, so it leaves nothing behind in TIME_WAIT
+ */
+static void refuse_connection(int connection_fd)
+{
+  struct linger linger = { 1, 0 };
+  setsockopt(connection_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  close(connection_fd);
+}
+
+/* wake_reactor - Interrupt the reactor select so it picks up new work from the AS layer right away
+ */
+static void wake_reactor(reactor_data* reactor)
+{
+  unsigned char wake = 0;
+  if (write(reactor->wake_fds[1], &wake, 1) < 0) {
+    // The pipe is already full, so the reactor is already on its way
+  }
+}
+
+/* start_reactor - Start the shared reactor thread if it is not already running, call with the reactor lock held
+ * return - 0 on success, otherwise the pthread_create error
+ */
+static int start_reactor(reactor_data* reactor)
+{
+  if (reactor->is_running) return 0;
+  
+  reactor->is_running = true;
+  int error = pthread_create(&reactor->thread, NULL, serverReactorThread, (void *)reactor);
+  if (error != 0) reactor->is_running = false;
+  
+  return error;
+}
+
+/* get_number_option - Read an optional numeric property from an AS options object
+ * return - true if the property was set
+ */
+static bool get_number_option(FREObject options, const char* name, double* value)
+{
+  FREObject fre_value = NULL;
+  if (options == NULL) return false;
+  if (FREGetObjectProperty(options, (const uint8_t*)name, &fre_value, NULL) != FRE_OK || fre_value == NULL) return false;
+  return FREGetObjectAsDouble(fre_value, value) == FRE_OK;
+}
+
+/* get_bool_option - Read an optional boolean property from an AS options object
+ * return - true if the property was set
+ */
+static bool get_bool_option(FREObject options, const char* name, bool* value)
+{
+  FREObject fre_value = NULL;
+  uint32_t flag = 0;
+  if (options == NULL) return false;
+  if (FREGetObjectProperty(options, (const uint8_t*)name, &fre_value, NULL) != FRE_OK || fre_value == NULL) return false;
+  if (FREGetObjectAsBool(fre_value, &flag) != FRE_OK) return false;
+  *value = flag != 0;
+  return true;
+}
+
+/* apply_listen_options - Apply the low latency options passed to listen, call with the reactor lock held and the reactor running
+ * The busy poll budget, CPU and priority belong to the shared reactor thread, so they affect every context.
+ * return - 0 on success, otherwise an errno value
+ */
+static int apply_listen_options(context_data* ctxdata, FREObject options)
+{
+  reactor_data* reactor = ctxdata->reactor;
+  double value = 0;
+  int error = 0;
+  
+  // Microseconds the reactor spins polling for activity before it blocks
+  if (get_number_option(options, "busyPoll", &value)) {
+    reactor->spin_ns = value > 0 ? (uint64_t)(value * 1000.0) : 0;
+  }
+  
+  // Microseconds the kernel busy polls the device queue for our sockets
+  if (get_number_option(options, "socketBusyPoll", &value)) {
+    ctxdata->socket_busy_poll = value > 0 ? (int)value : 0;
+  }
+  
+  // Pin the reactor thread to a core, -1 lets it float again
+  if (get_number_option(options, "cpu", &value)) {
+    error = ss_thread_set_affinity(reactor->thread, (int)value);
+    if (error != 0) return error;
+  }
+  
+  // Raise the reactor thread to real time priority, 0 puts it back on the default scheduler
+  if (get_number_option(options, "priority", &value)) {
+    error = ss_thread_set_priority(reactor->thread, (int)value);
+    if (error != 0) return error;
+  }
+  
+  // Let the reactor pick up the new spin budget right away
+  wake_reactor(reactor);
+  
+  return 0;
+}
+
+/* open_listener - Create a non-blocking server socket bound to the port and address
+ * return - 0 on success, otherwise -1 with errno set
+ */
+static int open_listener(listener_data* listener, int port, const char* address)
+{
+  int opt_val = 1; // YES
+  
+  // Create the socket file descriptor
+  listener->socket_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listener->socket_fd < 0) return -1;
+  
+  // Set the socket up for reuse
+  setsockopt(listener->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+  
+  // Set our server socket to non-blocking
+  if (fcntl(listener->socket_fd, F_SETFL, O_NONBLOCK) < 0) goto OpenListenerError;
+  
+  // Setup the sockaddr_in structure with the port and address
+  memset(&listener->sockaddr, 0, sizeof(listener->sockaddr));
+  listener->sockaddr.sin_family = AF_INET;
+  listener->sockaddr.sin_port = htons(port);
+  
+  // Bind to any, or bind to a specific address if provided
+  if (address == NULL || strcmp(address, "0.0.0.0") == 0) {
+    listener->sockaddr.sin_addr.s_addr = INADDR_ANY;
+  }
+  else {
+    inet_pton(AF_INET, address, &(listener->sockaddr.sin_addr));
+  }
+  
+  // Attempt to bind the socket to the port and interface
+  if (bind(listener->socket_fd, (struct sockaddr *)&listener->sockaddr, sizeof(listener->sockaddr)) < 0) goto OpenListenerError;
+  
+  // Get the port that we just bound to
+  struct sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+  if (getsockname(listener->socket_fd, (struct sockaddr *)&sin, &len) < 0) goto OpenListenerError;
+  listener->port = ntohs(sin.sin_port);
+  
+  return 0;
+  
+OpenListenerError:
+  opt_val = errno;
+  close(listener->socket_fd);
+  listener->socket_fd = -1;
+  errno = opt_val;
+  return -1;
+}
+
+/* start_listener - Start accepting connections on a bound listener, handing it to the reactor
+ * Call with the reactor lock held.
+ * return - 0 on success, otherwise -1 with errno set
+ */
+static int start_listener(context_data* ctxdata, listener_data* listener, int backlog)
+{
+  // Correct the backlog
+  if (backlog > SOMAXCONN) backlog = SOMAXCONN;
+  
+  // Open the socket for listening
+  if (listen(listener->socket_fd, backlog) < 0) return -1;
+  
+  // Hold a spare descriptor so we can still shed connections if we run out
+  if (ctxdata->reserve_fd < 0) ctxdata->reserve_fd = open("/dev/null", O_RDONLY);
+  
+  // Start the reactor thread if it is not already running, and have it pick up the listener
+  int error = start_reactor(ctxdata->reactor);
+  if (error != 0) { errno = error; return -1; }
+  listener->is_listening = true;
+  wake_reactor(ctxdata->reactor);
+  
+  return 0;
+}
+
+/* close_listener - Stop listening and close the server socket, call with the reactor lock held
+ */
+static void close_listener(listener_data* listener)
+{
+  // Shutting the socket down first stops it accepting right away, even while the reactor select still holds it
+  if (listener->socket_fd >= 0) {
+    shutdown(listener->socket_fd, SHUT_RDWR);
+    close(listener->socket_fd);
+  }
+  listener->socket_fd = -1;
+  listener->port = 0;
+  listener->is_listening = false;
+  listener->is_http = false;
+}
+
+/* socket_handle - The handle the AS layer knows the socket in a slot by
+ */
+static int socket_handle(context_data* ctxdata, int index)
+{
+  return index + SOMAXCONN * (int)(ctxdata->generations[index] % SS_HANDLE_GENERATIONS);
+}
+
+/* find_socket - Look up the socket behind a handle from the AS layer, call with the sockets lock held
+ * @param index - Set to the slot the socket is in, may be NULL
+ * return - The socket, or NULL if the handle belongs to a socket that is already gone
+ */
+static ss_socket* find_socket(context_data* ctxdata, int handle, int* index)
+{
+  if (handle < 0 || socket_handle(ctxdata, handle % SOMAXCONN) != handle) return NULL;
+  if (index != NULL) *index = handle % SOMAXCONN;
+  return ctxdata->sockets[handle % SOMAXCONN];
+}
+
+/* consume_buffer - Drop bytes from the front of a buffer, call with the buffer lock held
+ */
+static void consume_buffer(ss_buffer* buffer, int length)
+{
+  if (length > buffer->index) length = buffer->index;
+  buffer->index = buffer->index - length;
+  if (buffer->index > 0) memmove(buffer->buffer, &buffer->buffer[length], buffer->index);
+  buffer->last_active = ss_clock_ns();
+}
+
+/* refuse_http - Answer an HTTP request with an error and hang up, call with the read buffer lock held
+ * The rest of the input is thrown away, and the socket lingers for a while after the response is sent so the client
+ * gets to read it.
+ */
+static void refuse_http(ss_socket* s, const char* response)
+{
+  ss_send_queue_write(&s->send_queue, SS_PRIORITY_NORMAL, (const unsigned char*)response, strlen(response), true);
+  consume_buffer(&s->read_buffer, s->read_buffer.index);
+  s->notify_close = true;
+  s->discard_input = true;
+  s->state = SS_SOCKET_CLOSING;
+}
+
+/* advance_http - Parse the requests waiting in the read buffer of an HTTP socket
+ * GET requests for cached paths are answered right here. The first request that needs the AS layer is announced with an
+ * HttpRequest event, and requests pipelined behind it wait until the AS layer responds, so responses go out in order.
+ * Safe to call from the reactor and the AS thread, the read buffer lock guards the parser.
+ */
+static void advance_http(context_data* ctxdata, int index, ss_socket* s)
 {
   char event_level[128];
-  int i = 0, error = 0, num_sockets = 0, high_socket = 0;
-  struct timeval timeout;
-  context_data* ctxdata = (context_data *) pArg;
-  ss_socket* s = NULL;
-    
-  // Select list of sockets
-  fd_set socket_read_set, socket_write_set;
+  ss_http_request* request = s->http;
+  ss_buffer* in = &s->read_buffer;
+  bool announce = false;
   
-  ctxdata->is_listening = true;
-  while (ctxdata->is_listening) {
-    // Zero out our socket set
-    FD_ZERO(&socket_read_set); FD_ZERO(&socket_write_set);
+  pthread_mutex_lock(&in->lock);
+  while (s->state == SS_SOCKET_CONNECTED && request->awaiting_response == false && request->state != SS_HTTP_STATE_DONE && in->index > 0) {
+    ss_http_result result = ss_http_parse(request, in->buffer, in->index);
+    if (result == SS_HTTP_INCOMPLETE) break;
     
-    // Add our primary listening socket into the set
-    FD_SET(ctxdata->server_socket_fd, &socket_read_set);
-    
-    // Set the high_socket to at least our listener
-    high_socket = ctxdata->server_socket_fd;
+    // There is no telling where the next request starts after a malformed or oversized one, answer it and hang up
+    if (result == SS_HTTP_INVALID || result == SS_HTTP_TOO_LARGE) {
+      refuse_http(s, result == SS_HTTP_INVALID ? HTTP_BAD_REQUEST : HTTP_TOO_LARGE);
+      break;
+    }
     
-    // Add all other sockets into the set
-    for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
-      s = ctxdata->sockets[i]; if (s == NULL) continue;
-      
-      // And the socket to the read set always, and the write set if we have data
-      FD_SET(s->socket_desc, &socket_read_set);
-      if (s->write_buffer.index > 0) {
-        FD_SET(s->socket_desc, &socket_write_set);
+    // Serve cached paths without involving the AS layer, shedding the connection if memory is too tight to queue them
+    ss_http_cache_result cached = SS_HTTP_CACHE_MISS;
+    if (ss_http_span_equals(in->buffer, request->method, "get")) {
+      cached = ss_http_cache_serve(&ctxdata->http_cache, &in->buffer[request->path.offset], request->path.length, &s->send_queue, &ctxdata->budget);
+    }
+    if (cached == SS_HTTP_CACHE_OVER_BUDGET) {
+      refuse_http(s, HTTP_UNAVAILABLE);
+      break;
+    }
+    if (cached == SS_HTTP_CACHE_SERVED) {
+      bool keep_alive = request->keep_alive;
+      consume_buffer(in, request->length);
+      ss_http_reset(request);
+      if (keep_alive == false) {
+        s->notify_close = true;
+        s->state = SS_SOCKET_CLOSING;
       }
-      
-      // Store the high socket for select
-      if (s->socket_desc > high_socket) high_socket = s->socket_desc;
+      continue;
     }
     
-    // Set our timeout value so we don't block forever (512ms)
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 512000;
+    // Everything else goes to the AS layer
+    announce = true;
+  }
+  pthread_mutex_unlock(&in->lock);
+  
+  if (announce) {
+    // Dispatch HttpRequest Status Event, with the handle of the socket
+    #pragma mark StatusEvent -> HttpRequest
+    sprintf(event_level, "%d", socket_handle(ctxdata, index));
+    FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"HttpRequest", (const uint8_t*)event_level);
+  }
+}
+
+/* http_waiting - Check if an HTTP socket is part way through a request, or still owes responses to requests it took in
+ * @param partial - Set to true if the parser is waiting on more of a request, rather than on the AS layer
+ * return - true while the socket has a request that is not answered yet
+ */
+static bool http_waiting(ss_socket* s, bool* partial)
+{
+  if (s->http == NULL) return false;
+  
+  pthread_mutex_lock(&s->read_buffer.lock);
+  bool announced = s->http->awaiting_response || s->http->state == SS_HTTP_STATE_DONE;
+  bool in_progress = announced == false && s->read_buffer.index > 0;
+  pthread_mutex_unlock(&s->read_buffer.lock);
+  
+  if (partial != NULL) *partial = in_progress;
+  return announced;
+}
+
+/* http_expired - Check if an HTTP client has run out of time to send the head of its next request
+ * The clock starts once the previous response is handed over, so this bounds idle keep alive connections and slow
+ * headers alike. Bodies are bounded by size rather than time.
+ */
+static bool http_expired(ss_socket* s, uint64_t now)
+{
+  if (s->http == NULL || s->state != SS_SOCKET_CONNECTED) return false;
+  
+  pthread_mutex_lock(&s->read_buffer.lock);
+  bool waiting = s->http->awaiting_response == false && s->http->state == SS_HTTP_STATE_HEAD;
+  bool expired = waiting && now - s->http->started >= HTTP_HEAD_TIMEOUT_NS;
+  pthread_mutex_unlock(&s->read_buffer.lock);
+  
+  return expired && ss_send_queue_pending(&s->send_queue) == 0;
+}
+
+/* release_socket - Take a socket out of the table, then close its connection or park it in the pool
+ * Must only be called from the reactor thread.
+ */
+static void release_socket(context_data* ctxdata, int index, bool notify)
+{
+  char event_level[128];
+  ss_socket* s = ctxdata->sockets[index];
+  int handle = socket_handle(ctxdata, index);
+  
+  // Make sure the AS layer is not in the middle of using the socket, and retire its handle
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  ctxdata->sockets[index] = NULL;
+  ctxdata->generations[index]++;
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
+  
+  // Keep alive connections are only pooled if they are clean, leftover data would confuse the next user
+  bool pooled = s->keep_alive && s->is_outbound && s->read_buffer.index == 0 && ss_send_queue_pending(&s->send_queue) == 0
+             && ss_pool_put(&ctxdata->pool, &s->remote_address, s->socket_desc);
+  if (pooled == false) {
+    ss_capture_write(SS_CAPTURE_CLOSE, s->socket_desc, NULL, 0);
+    close(s->socket_desc);
     
-    // Select on our sockets
-    num_sockets = select(high_socket+1, &socket_read_set, &socket_write_set, (fd_set *)NULL, &timeout);
-    if (num_sockets <= 0) continue;
+    // A descriptor just came free, so listeners that ran out can accept again
+    ctxdata->accept_resume = 0;
+  }
+  ss_free(s);
+  
+  if (notify) {
+    // Dispatch SocketClosed Status Event, with the handle of the socket
+    #pragma mark StatusEvent -> SocketClosed
+    sprintf(event_level, "%d", handle);
+    FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketClosed", (const uint8_t*)event_level);
+  }
+}
+
+/* accept_connections - Drain a listen backlog, up to ACCEPT_BUDGET connections per wakeup
+ * Connections are checked against the admission limits before any memory is allocated for them.
+ */
+static void accept_connections(context_data* ctxdata, listener_data* listener)
+{
+  char event_level[128];
+  int i = 0, accepted = 0;
+  ss_socket* s = NULL;
+  
+  for (accepted = 0; accepted < ACCEPT_BUDGET; ++accepted) {
+    // Get the new connection
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    int connection_fd = ss_accept(listener->socket_fd, (struct sockaddr *)&peer, &peer_len);
     
-    // Check to see if we have a pending connection
-    ////
-    if (FD_ISSET(ctxdata->server_socket_fd, &socket_read_set)) {
-      // Clear this socket from the set
-      FD_CLR(ctxdata->server_socket_fd, &socket_read_set);
+    // Handle an error if needed, none of these are fatal to the listening socket
+    if (connection_fd < 0) {
+      // The backlog is empty
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
       
-      // Get the new connection
-      int connection_fd = accept(ctxdata->server_socket_fd, NULL, NULL);
+      // The connection went away before we got to it, move on to the next one
+      if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
       
-      // Handle an error if needed
-      if (connection_fd < 0) {
-        close(ctxdata->server_socket_fd);
-        
+      // Out of descriptors, use our reserve to accept and reset the connection so it does not wake us again
+      bool out_of_descriptors = errno == EMFILE || errno == ENFILE;
+      if (out_of_descriptors && ctxdata->reserve_fd >= 0) {
+        close(ctxdata->reserve_fd);
+        connection_fd = accept(listener->socket_fd, NULL, NULL);
+        if (connection_fd >= 0) refuse_connection(connection_fd);
+        ctxdata->reserve_fd = open("/dev/null", O_RDONLY);
+      }
+      // Without a reserve the connection stays in the backlog and the listener stays readable, so stop watching it
+      // until one of our sockets closes or the backoff runs out, rather than spinning on it
+      else if (out_of_descriptors) {
+        ctxdata->accept_resume = ss_clock_ns() + ACCEPT_BACKOFF_NS;
+      }
+      
+      // Running out of descriptors is reported once, until an accept succeeds again
+      if (out_of_descriptors == false || ctxdata->descriptors_exhausted == false) {
         // Dispatch SocketIOError Status Event, with an error message
         #pragma mark StatusEvent -> SocketIOError
         FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketIOError", (const uint8_t*)"Incoming socket rejected");
-        
+      }
+      ctxdata->descriptors_exhausted = out_of_descriptors;
+      break;
+    }
+    ctxdata->descriptors_exhausted = false;
+    
+    // Enforce our admission limits before doing any work for the connection
+    if (ss_admission_admit(&ctxdata->admission, peer.sin_addr.s_addr) == false) {
+      refuse_connection(connection_fd);
+      continue;
+    }
+    
+    // Refuse new connections while the memory budget cannot cover their buffers
+    if (ss_budget_exhausted(&ctxdata->budget, 2 * SS_BUFFER_SIZE)) {
+      refuse_connection(connection_fd);
+      continue;
+    }
+    
+    // Find a home for this connection
+    pthread_mutex_lock(&ctxdata->sockets_lock);
+    for (i = 0; i < SOMAXCONN; ++i) {
+      if (ctxdata->sockets[i] == NULL) break;
+    }
+    s = i < SOMAXCONN ? ctxdata->sockets[i] = ss_alloc(connection_fd, &ctxdata->budget) : NULL;
+    pthread_mutex_unlock(&ctxdata->sockets_lock);
+    
+    // Refuse the connection if we are unable to store it
+    if (s == NULL) { refuse_connection(connection_fd); continue; }
+    
+    // Connections to HTTP listeners get a request parser
+    if (listener->is_http) {
+      s->http = malloc(sizeof(ss_http_request));
+      if (s->http != NULL) ss_http_reset(s->http);
+    }
+    
+    ss_capture_write(SS_CAPTURE_ACCEPT, s->socket_desc, NULL, 0);
+    if (ss_trace_enabled()) ss_trace_enable_socket(s->socket_desc);
+    if (ctxdata->socket_busy_poll > 0) ss_busy_poll(s->socket_desc, ctxdata->socket_busy_poll);
+    
+    // Dispatch SocketOpened Status Event, with the handle of the socket, the port it came in on, and whether it speaks HTTP
+    #pragma mark StatusEvent -> SocketOpened
+    sprintf(event_level, "%d,%d,%d", socket_handle(ctxdata, i), listener->port, s->http != NULL);
+    FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketOpened", (const uint8_t*)event_level);
+  }
+}
+
+/* shutdown_context - Close every socket and listener of a context, call from the reactor thread or with the reactor stopped
+ */
+static void shutdown_context(context_data* ctxdata)
+{
+  int i = 0;
+  bool was_open = ctxdata->reserve_fd >= 0;
+  
+  // Disconnect everyone and free up our sockets
+  for (i = 0; i < SOMAXCONN; ++i) {
+    if (ctxdata->sockets[i] == NULL) continue;
+    was_open = true;
+    ctxdata->sockets[i]->keep_alive = false;
+    release_socket(ctxdata, i, false);
+  }
+  
+  // Release the listening sockets and our spare descriptor
+  for (i = 0; i < SS_MAX_LISTENERS; ++i) {
+    close_listener(&ctxdata->listeners[i]);
+  }
+  if (ctxdata->reserve_fd >= 0) close(ctxdata->reserve_fd);
+  ctxdata->reserve_fd = -1;
+  
+  // A context that never listened or connected has nothing to announce
+  if (was_open == false) return;
+  
+  // Dispatch SocketShutdown Status Event, letting the AS layer know that the server closed and all sockets are invalid
+  #pragma mark StatusEvent -> SocketShutdown
+  FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketShutdown", (const uint8_t*)"");
+}
+
+/* watch_context - Add the listeners and sockets of a context to the select sets
+ * Sockets holding bulk data back for the in flight limit set throttled, so the reactor checks on them again soon.
+ * return - true if the context has buffers or pooled connections that need the reactor to wake up on its own
+ */
+static bool watch_context(context_data* ctxdata, fd_set* read_set, fd_set* write_set, int* high_socket, uint64_t now, bool* throttled)
+{
+  int i = 0;
+  bool timed = ctxdata->pool.count > 0;
+  ss_socket* s = NULL;
+  
+  // Listeners that ran out of descriptors sit out the backoff
+  bool accept_paused = now < ctxdata->accept_resume;
+  if (accept_paused) timed = true;
+  
+  // Add our listening sockets into the set
+  for (i = 0; i < SS_MAX_LISTENERS && accept_paused == false; ++i) {
+    listener_data* listener = &ctxdata->listeners[i];
+    if (listener->is_listening == false) continue;
+    
+    // Get our reserve back if we had to give it up
+    if (ctxdata->reserve_fd < 0) ctxdata->reserve_fd = open("/dev/null", O_RDONLY);
+    FD_SET(listener->socket_fd, read_set);
+    if (listener->socket_fd > *high_socket) *high_socket = listener->socket_fd;
+  }
+  
+  // Close idle pooled connections that have outstayed their welcome, and watch the rest for the peer closing them
+  ss_pool_expire(&ctxdata->pool, now);
+  ss_pool_watch(&ctxdata->pool, read_set, high_socket);
+  
+  // Add all other sockets into the set
+  for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
+    s = ctxdata->sockets[i]; if (s == NULL) continue;
+    
+    // Outbound connections only care about the connect completing
+    if (s->state == SS_SOCKET_CONNECTING) {
+      FD_SET(s->socket_desc, write_set);
+      if (s->socket_desc > *high_socket) *high_socket = s->socket_desc;
+      continue;
+    }
+    
+    // Sockets the AS layer closed are released once their pending data is flushed. HTTP sockets that answered with an
+    // error first shut down their side and drain input for a while, closing on unread input would reset the connection
+    // and could take the response with it.
+    if (s->state == SS_SOCKET_CLOSING && ss_send_queue_pending(&s->send_queue) == 0) {
+      if (s->discard_input && s->linger_until == 0) {
+        shutdown(s->socket_desc, SHUT_WR);
+        s->linger_until = now + HTTP_LINGER_NS;
+      }
+      if (now >= s->linger_until) {
+        release_socket(ctxdata, i, s->notify_close);
         continue;
       }
-      
-      // Find a home for this connection
-      for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
-        s = ctxdata->sockets[i];
-        if (s == NULL) { s = ctxdata->sockets[i] = ss_alloc(connection_fd); break; }
+      timed = true;
+    }
+    
+    // HTTP clients that take too long to send a request are let go
+    if (http_expired(s, now)) {
+      release_socket(ctxdata, i, true);
+      continue;
+    }
+    if (s->http != NULL && s->state == SS_SOCKET_CONNECTED) timed = true;
+    
+    // HTTP sockets the peer stopped sending on are released once every request that did arrive is answered and sent
+    bool partial = false;
+    bool answering = http_waiting(s, &partial);
+    if (s->peer_closed && answering == false && ss_send_queue_pending(&s->send_queue) == 0) {
+      release_socket(ctxdata, i, true);
+      continue;
+    }
+    
+    // Give back memory from buffers that have been quiet for long enough, waking up on our own only while some are left to shrink
+    if (ss_shrink(&s->read_buffer, now)) timed = true;
+    if (ss_send_queue_shrink(&s->send_queue, now)) timed = true;
+    
+    // When memory is tight stop reading from sockets that are still holding data, if the next read would have to grow
+    // their buffer past the budget. Buffers grow by size class, so the check is against the real growth, not the read size.
+    // HTTP requests part way in could never finish and give their memory back, so they keep reading up to the request cap.
+    int growth = s->read_buffer.index > 0 ? ss_buffer_growth(&s->read_buffer, READ_LENGTH) : 0;
+    bool paused = growth > 0 && ss_budget_exhausted(&ctxdata->budget, growth) && (partial == false || s->read_buffer.index >= SS_HTTP_MAX_REQUEST);
+    
+    // And the socket to the read set unless it is paused, and the write set if we have data.
+    // The AS layer does not wake us when it reads, so paused sockets are checked on again by the timeout.
+    // Sockets the peer stopped sending on have nothing left to read.
+    if (s->peer_closed == false) {
+      if (paused == false) {
+        FD_SET(s->socket_desc, read_set);
       }
+      else {
+        timed = true;
+      }
+    }
+    if (ss_send_queue_ready(&s->send_queue, &ctxdata->send_policy, s->socket_desc, throttled)) {
+      FD_SET(s->socket_desc, write_set);
+    }
+    
+    // Store the high socket for select
+    if (s->socket_desc > *high_socket) *high_socket = s->socket_desc;
+  }
+  
+  return timed;
+}
+
+/* service_context - Accept, connect, read and write whatever select found ready for a context
+ */
+static void service_context(context_data* ctxdata, fd_set* read_set, fd_set* write_set)
+{
+  char event_level[128];
+  int i = 0;
+  ss_socket* s = NULL;
+  
+  // Drop pooled connections the peer closed
+  ss_pool_reap(&ctxdata->pool, read_set);
+  
+  // Check to see if we have pending connections
+  ////
+  for (i = 0; i < SS_MAX_LISTENERS; ++i) {
+    listener_data* listener = &ctxdata->listeners[i];
+    if (listener->is_listening && FD_ISSET(listener->socket_fd, read_set)) {
+      // Clear this socket from the set
+      FD_CLR(listener->socket_fd, read_set);
+      accept_connections(ctxdata, listener);
+    }
+  }
+  
+  // Check to see if we need to read or write...
+  for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
+    s = ctxdata->sockets[i]; if (s == NULL) continue;
+    
+    // Finish connecting outbound sockets
+    ////
+    if (s->state == SS_SOCKET_CONNECTING) {
+      if (FD_ISSET(s->socket_desc, write_set) == false) continue;
+      FD_CLR(s->socket_desc, write_set);
       
-      // Refuse the connection if we are unable to store it
-      if (s == NULL) { close(connection_fd); continue; }
+      int connect_error = 0;
+      socklen_t connect_error_len = sizeof(connect_error);
+      if (getsockopt(s->socket_desc, SOL_SOCKET, SO_ERROR, &connect_error, &connect_error_len) < 0) connect_error = errno;
       
-      // Set the incoming socket to non-blocking
-      error = fcntl(s->socket_desc, F_SETFL, O_NONBLOCK);
-      if (error < 0) {
-        close(s->socket_desc);
-        ss_free(s);
+      if (connect_error == 0) {
+        s->state = SS_SOCKET_CONNECTED;
         
-        // Dispatch SocketIOError Status Event, with an error message
-        #pragma mark StatusEvent -> SocketIOError
-        FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketIOError", (const uint8_t*)"Incoming socket rejected, unable to set the socket to non-blocking mode");
+        // Dispatch SocketConnected Status Event, with the handle of the socket
+        #pragma mark StatusEvent -> SocketConnected
+        sprintf(event_level, "%d", socket_handle(ctxdata, i));
+        FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketConnected", (const uint8_t*)event_level);
+      }
+      else {
+        int handle = socket_handle(ctxdata, i);
+        release_socket(ctxdata, i, false);
         
-        continue;
+        // Dispatch SocketConnectError Status Event, with the handle of the socket and an error message
+        #pragma mark StatusEvent -> SocketConnectError
+        snprintf(event_level, sizeof(event_level), "%d,%s", handle, strerror(connect_error));
+        FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketConnectError", (const uint8_t*)event_level);
       }
-      
-      // Dispatch SocketOpened Status Event, with the index of the socket
-      #pragma mark StatusEvent -> SocketOpened
-      sprintf(event_level, "%d", i);
-      FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketOpened", (const uint8_t*)event_level);
+      continue;
     }
     
-    // Check to see if we need to read or write...
-    for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
-      s = ctxdata->sockets[i]; if (s == NULL) continue;
+    // Read the data from the socket
+    ////
+    if (FD_ISSET(s->socket_desc, read_set)) {
+      FD_CLR(s->socket_desc, read_set);
       
-      // Read the data from the socket
-      ////
-      if (FD_ISSET(s->socket_desc, &socket_read_set)) {
-        FD_CLR(s->socket_desc, &socket_read_set);
+      bool tracing = ss_trace_enabled();
+      uint64_t kernel_time = 0, dequeued = 0, dispatched = 0;
+      
+      int len = ss_recv(s->socket_desc, &s->read_buffer, READ_LENGTH, tracing ? &kernel_time : NULL);
+      if (len > 0) {
+        // Nobody is listening for data on a socket the AS layer closed, and lingering HTTP sockets throw it away
+        if (s->state == SS_SOCKET_CLOSING) {
+          if (s->discard_input) {
+            pthread_mutex_lock(&s->read_buffer.lock);
+            consume_buffer(&s->read_buffer, s->read_buffer.index);
+            pthread_mutex_unlock(&s->read_buffer.lock);
+          }
+          continue;
+        }
         
-        int len = ss_recv(s->socket_desc, &s->read_buffer, READ_LENGTH);
-        if (len > 0) {
-          // Dispatch SocketDataReady Status Event, with the index of the socket, and the length of the data
-          #pragma mark StatusEvent -> SocketDataReady
-          sprintf(event_level, "%d,%d", i, len);
-          FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketDataReady", (const uint8_t*)event_level);
+        if (tracing) {
+          dequeued = ss_clock_ns();
           
+          // Kernel timestamps are wall clock, so measure that stage against the wall clock too
+          uint64_t realtime = ss_trace_realtime_ns();
+          if (kernel_time > 0 && realtime > kernel_time) ss_trace_record(SS_TRACE_KERNEL_TO_REACTOR, realtime - kernel_time);
         }
-        else if (len == 0) {
-          // Connection was closed
-          ss_free(s);
-          s = ctxdata->sockets[i] = NULL;
-          
-          // Dispatch SocketClosed Status Event, with the index of the socket
-          #pragma mark StatusEvent -> SocketClosed
-          sprintf(event_level, "%d", i);
-          FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketClosed", (const uint8_t*)event_level);
-          
-          // Since the socket is closed skip to the next socket
+        
+        // HTTP sockets only bother the AS layer once a whole request is in
+        if (s->http != NULL) {
+          advance_http(ctxdata, i, s);
           continue;
         }
-        else {
-          // Dispatch SocketIOError Status Event, with an error message
-          #pragma mark StatusEvent -> SocketIOError
-          FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketIOError", (const uint8_t*)strerror(errno));
+        
+        // Dispatch SocketDataReady Status Event, with the handle of the socket, and the length of the data
+        #pragma mark StatusEvent -> SocketDataReady
+        sprintf(event_level, "%d,%d", socket_handle(ctxdata, i), len);
+        
+        // Queue the chunk timestamps before the event goes out so the AS read can never beat them
+        if (tracing) {
+          dispatched = ss_clock_ns();
+          ss_trace_record(SS_TRACE_REACTOR_TO_DISPATCH, dispatched - dequeued);
         }
-      }
-      
-      // Write the data to the socket
-      ////
-      if (FD_ISSET(s->socket_desc, &socket_write_set)) {
-        FD_CLR(s->socket_desc, &socket_write_set);
+        ss_trace_push(&s->recv_trace, dequeued, dispatched, len);
+        FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketDataReady", (const uint8_t*)event_level);
         
-        int len = ss_send(s->socket_desc, &s->write_buffer);
+      }
+      else if (len == 0 && s->http != NULL && s->state == SS_SOCKET_CONNECTED) {
+        // The peer is done sending, but requests it pipelined before that still get their responses
+        s->peer_closed = true;
+        continue;
+      }
+      else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Connection was closed or reset, let the AS layer know unless it closed the socket itself
         if (len < 0) {
           // Dispatch SocketIOError Status Event, with an error message
           #pragma mark StatusEvent -> SocketIOError
           FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketIOError", (const uint8_t*)strerror(errno));
         }
+        release_socket(ctxdata, i, s->state != SS_SOCKET_CLOSING || s->notify_close);
+        
+        // Since the socket is closed skip to the next socket
+        continue;
       }
     }
+    
+    // Write the data to the socket
+    ////
+    if (FD_ISSET(s->socket_desc, write_set)) {
+      FD_CLR(s->socket_desc, write_set);
+      
+      // Classes go out a message at a time, so the trace is only exact while a socket sticks to one class.
+      // HTTP sockets queue responses from the reactor too, so they are left out of send tracing.
+      int len = ss_send_queue_flush(&s->send_queue, &ctxdata->send_policy, s->socket_desc);
+      if (len > 0) {
+        if (s->http == NULL) ss_trace_consume(&s->send_trace, len, SS_TRACE_STAGE_COUNT, SS_TRACE_SEND_TO_TRANSMIT);
+      }
+      else if (len < 0 && (s->state == SS_SOCKET_CLOSING || s->peer_closed)) {
+        // We can not flush a socket that is going away, drop it
+        release_socket(ctxdata, i, s->notify_close || s->peer_closed);
+      }
+      else if (len < 0) {
+        // Dispatch SocketIOError Status Event, with an error message
+        #pragma mark StatusEvent -> SocketIOError
+        FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketIOError", (const uint8_t*)strerror(errno));
+      }
+    }
+  }
+}
+
+/* wait_for_sockets - Select on the sockets, spinning on non-blocking polls for the spin budget before blocking
+ * Called without the reactor lock, the poll and sleep counts are handed back for the caller to add up.
+ * return - the select result, with the sets narrowed down to the ready sockets
+ */
+static int wait_for_sockets(uint64_t spin_ns, int high_socket, fd_set* read_set, fd_set* write_set, struct timeval* timeout, uint64_t* polls, uint64_t* sleeps)
+{
+  if (spin_ns > 0) {
+    fd_set read_ready, write_ready;
+    struct timeval no_wait;
+    uint64_t deadline = ss_clock_ns() + spin_ns;
+    
+    do {
+      // Select clobbers the sets, so poll with copies
+      read_ready = *read_set;
+      write_ready = *write_set;
+      no_wait.tv_sec = no_wait.tv_usec = 0;
+      
+      int num_sockets = select(high_socket+1, &read_ready, &write_ready, (fd_set *)NULL, &no_wait);
+      (*polls)++;
+      if (num_sockets != 0) {
+        *read_set = read_ready;
+        *write_set = write_ready;
+        return num_sockets;
+      }
+    } while (ss_clock_ns() < deadline);
+  }
+  
+  // Nothing turned up while spinning, go to sleep
+  (*sleeps)++;
+  return select(high_socket+1, read_set, write_set, (fd_set *)NULL, timeout);
+}
+
+void* serverReactorThread(void *pArg)
+{
+  unsigned char wake_data[64];
+  int num_sockets = 0, high_socket = 0;
+  struct timeval timeout;
+  reactor_data* reactor = (reactor_data *) pArg;
+  context_data* ctxdata = NULL;
+    
+  // Select list of sockets
+  fd_set socket_read_set, socket_write_set;
+  
+  pthread_mutex_lock(&reactor->lock);
+  while (reactor->is_running) {
+    // Zero out our socket set
+    FD_ZERO(&socket_read_set); FD_ZERO(&socket_write_set);
+    
+    // Add our wake pipe into the set, so new work from the AS layer does not wait on the timeout
+    FD_SET(reactor->wake_fds[0], &socket_read_set);
+    high_socket = reactor->wake_fds[0];
+    
+    // Shut down the contexts that asked to close, and add everyone else's sockets into the set
+    uint64_t now = ss_clock_ns();
+    bool timed = false, throttled = false;
+    for (ctxdata = reactor->contexts; ctxdata != NULL; ctxdata = ctxdata->next) {
+      if (ctxdata->is_closing) {
+        shutdown_context(ctxdata);
+        ctxdata->is_closing = false;
+        pthread_cond_broadcast(&reactor->closed);
+        continue;
+      }
+      if (watch_context(ctxdata, &socket_read_set, &socket_write_set, &high_socket, now, &throttled)) timed = true;
+    }
+    
+    // Sleep until something happens, only waking up on our own (every 512ms) when buffers or the pool need attention,
+    // or within a millisecond when bulk data is waiting for the kernel to drain
+    timeout.tv_sec = 0;
+    timeout.tv_usec = throttled ? SEND_THROTTLE_USEC : 512000;
+    
+    // Select on our sockets, letting the AS layer at the contexts in the meantime
+    uint64_t spin_ns = reactor->spin_ns, polls = 0, sleeps = 0;
+    pthread_mutex_unlock(&reactor->lock);
+    num_sockets = wait_for_sockets(spin_ns, high_socket, &socket_read_set, &socket_write_set, timed || throttled ? &timeout : NULL, &polls, &sleeps);
+    pthread_mutex_lock(&reactor->lock);
+    
+    // Keep track of what we cost
+    reactor->cpu_ns = ss_thread_cpu_ns();
+    reactor->polls += polls;
+    reactor->sleeps += sleeps;
+    if (num_sockets <= 0) continue;
+    
+    // Drain the wake pipe, the wakeup itself was the message
+    if (FD_ISSET(reactor->wake_fds[0], &socket_read_set)) {
+      while (read(reactor->wake_fds[0], wake_data, sizeof(wake_data)) > 0);
+    }
+    
+    // Service every context, the events go out to the context that owns the socket
+    for (ctxdata = reactor->contexts; ctxdata != NULL; ctxdata = ctxdata->next) {
+      if (ctxdata->is_closing == false) service_context(ctxdata, &socket_read_set, &socket_write_set);
+    }
+  }
+  pthread_mutex_unlock(&reactor->lock);
+  
+  return NULL;
+}
+
+/* ServerSocketExtInitializer()
+ * The extension initializer is called the first time the ActionScript side of the extension
+ * calls ExtensionContext.createExtensionContext() for any context.
+ *
+ * Please note: this should be same as the <initializer> specified in the extension.xml
+ */
+void ServerSocketExtInitializer(void** extDataToSet, FREContextInitializer* ctxInitializerToSet, FREContextFinalizer* ctxFinalizerToSet)
+{
+  // Every context shares one reactor, its thread starts when the first context needs it
+  reactor_data* reactor = reactor_data_alloc();
+  reactor->base_time = ss_clock_ns();
+  *extDataToSet = reactor;
+  *ctxInitializerToSet = &ServerSocketContextInitializer;
+  *ctxFinalizerToSet = &ServerSocketContextFinalizer;
+}
+
+/* ServerSocketExtFinalizer()
+ * The extension finalizer is called when the runtime unloads the extension. However, it may not always called.
+ *
+ * Please note: this should be same as the <finalizer> specified in the extension.xml
+ */
+void ServerSocketExtFinalizer(void* extData)
+{
+  reactor_data* reactor = (reactor_data *) extData;
+  
+  // Stop the reactor thread
+  if (reactor != NULL) {
+    pthread_mutex_lock(&reactor->lock);
+    bool was_running = reactor->is_running;
+    reactor->is_running = false;
+    wake_reactor(reactor);
+    pthread_mutex_unlock(&reactor->lock);
+    if (was_running) pthread_join(reactor->thread, NULL);
+    reactor_data_free(reactor);
+  }
+  
+  // Make sure any running capture makes it to disk
+  ss_capture_close();
+}
+
+/* ContextInitializer()
+ * The context initializer is called when the runtime creates the extension context instance.
+ */
+void ServerSocketContextInitializer(void* extData, const uint8_t* ctxType, FREContext ctx, uint32_t* numFunctionsToTest, const FRENamedFunction** functionsToSet)
+{  
+  // Initialize our context data
+  context_data* ctxdata = context_data_alloc();
+  ctxdata->ctx = ctx;
+  FRESetContextNativeData(ctx, ctxdata);
+  
+  // Register with the shared reactor
+  reactor_data* reactor = (reactor_data *) extData;
+  ctxdata->reactor = reactor;
+  pthread_mutex_lock(&reactor->lock);
+  ctxdata->next = reactor->contexts;
+  reactor->contexts = ctxdata;
+  pthread_mutex_unlock(&reactor->lock);
+
+  
+  /* The following code describes the functions that are exposed by this native extension to the ActionScript code.
+   * As a sample, the function isSupported is being provided.
+   */
+  *numFunctionsToTest = 22;
+  
+  FRENamedFunction* func = (FRENamedFunction*) malloc(sizeof(FRENamedFunction) * (*numFunctionsToTest));
+  
+  func[0].name = (const uint8_t*) "close";
+  func[0].functionData = NULL;
+  func[0].function = &ServerSocketClose;
+  
+  func[1].name = (const uint8_t*) "bind";
+  func[1].functionData = NULL;
+  func[1].function = &ServerSocketBind;
+    
+  func[2].name = (const uint8_t*) "listen";
+  func[2].functionData = NULL;
+  func[2].function = &ServerSocketListen;
+  
+  func[3].name = (const uint8_t*) "send";
+  func[3].functionData = NULL;
+  func[3].function = &ServerSocketSend;
+  
+  func[4].name = (const uint8_t*) "recv";
+  func[4].functionData = NULL;
+  func[4].function = &ServerSocketRecv;
+  
+  func[5].name = (const uint8_t*) "startCapture";
+  func[5].functionData = NULL;
+  func[5].function = &ServerSocketStartCapture;
+  
+  func[6].name = (const uint8_t*) "stopCapture";
+  func[6].functionData = NULL;
+  func[6].function = &ServerSocketStopCapture;
+  
+  func[7].name = (const uint8_t*) "startTrace";
+  func[7].functionData = NULL;
+  func[7].function = &ServerSocketStartTrace;
+  
+  func[8].name = (const uint8_t*) "stopTrace";
+  func[8].functionData = NULL;
+  func[8].function = &ServerSocketStopTrace;
+  
+  func[9].name = (const uint8_t*) "traceStats";
+  func[9].functionData = NULL;
+  func[9].function = &ServerSocketTraceStats;
+  
+  func[10].name = (const uint8_t*) "admission";
+  func[10].functionData = NULL;
+  func[10].function = &ServerSocketAdmission;
+  
+  func[11].name = (const uint8_t*) "memoryBudget";
+  func[11].functionData = NULL;
+  func[11].function = &ServerSocketMemoryBudget;
+  
+  func[12].name = (const uint8_t*) "memoryUsage";
+  func[12].functionData = NULL;
+  func[12].function = &ServerSocketMemoryUsage;
+  
+  func[13].name = (const uint8_t*) "connect";
+  func[13].functionData = NULL;
+  func[13].function = &ServerSocketConnect;
+  
+  func[14].name = (const uint8_t*) "closeSocket";
+  func[14].functionData = NULL;
+  func[14].function = &ServerSocketCloseSocket;
+  
+  func[15].name = (const uint8_t*) "connectionPool";
+  func[15].functionData = NULL;
+  func[15].function = &ServerSocketConnectionPool;
+  
+  func[16].name = (const uint8_t*) "addListener";
+  func[16].functionData = NULL;
+  func[16].function = &ServerSocketAddListener;
+  
+  func[17].name = (const uint8_t*) "removeListener";
+  func[17].functionData = NULL;
+  func[17].function = &ServerSocketRemoveListener;
+  
+  func[18].name = (const uint8_t*) "reactorStats";
+  func[18].functionData = NULL;
+  func[18].function = &ServerSocketReactorStats;
+  
+  func[19].name = (const uint8_t*) "httpRequest";
+  func[19].functionData = NULL;
+  func[19].function = &ServerSocketHttpRequest;
+  
+  func[20].name = (const uint8_t*) "httpCache";
+  func[20].functionData = NULL;
+  func[20].function = &ServerSocketHttpCache;
+  
+  func[21].name = (const uint8_t*) "sendScheduling";
+  func[21].functionData = NULL;
+  func[21].function = &ServerSocketSendScheduling;
+  
+  *functionsToSet = func;
+}
+
+/* ContextFinalizer()
+ * The context finalizer is called when the extension's ActionScript code
+ * calls the ExtensionContext instance's dispose() method.
+ * If the AIR runtime garbage collector disposes of the ExtensionContext instance, the runtime also calls ContextFinalizer().
+ */
+void ServerSocketContextFinalizer(FREContext ctx)
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return;
+  
+  // Shutdown the server
+  ServerSocketClose(ctx, NULL, 0, NULL);
+  
+  // Leave the reactor, it only looks at the context list while holding the lock
+  reactor_data* reactor = ctxdata->reactor;
+  pthread_mutex_lock(&reactor->lock);
+  context_data** link = &reactor->contexts;
+  while (*link != NULL && *link != ctxdata) link = &(*link)->next;
+  if (*link != NULL) *link = ctxdata->next;
+  pthread_mutex_unlock(&reactor->lock);
+  
+  // Cleanup our context data
+  context_data_free(ctxdata);
+  FRESetContextNativeData(ctx, NULL);
+}
+
+FREObject ServerSocketClose(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  reactor_data* reactor = ctxdata->reactor;
+  pthread_mutex_lock(&reactor->lock);
+  if (reactor->is_running == false) {
+    // Without a reactor thread there is nobody else to close our sockets
+    shutdown_context(ctxdata);
+  }
+  else {
+    // Have the reactor close every socket on its next pass, the thread keeps running for the other contexts
+    ctxdata->is_closing = true;
+    wake_reactor(reactor);
+    while (ctxdata->is_closing && reactor->is_running) pthread_cond_wait(&reactor->closed, &reactor->lock);
   }
+  pthread_mutex_unlock(&reactor->lock);
+  
+  return NULL;
+}
+
+/* bind(localPort:int = 0, localAddress:String = "0.0.0.0"):void
+ * Bind to the local port and local address passed in from AS
+ * return - result object
+ */
+FREObject ServerSocketBind(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  listener_data* listener = &ctxdata->listeners[0];
+  if (listener->socket_fd >= 0) return NULL;
+  
+  // Read the values from the AS layer
+  int port = 0;
+  uint32_t address_length = 0;
+  const char* address = NULL;
+  FREGetObjectAsInt32(argv[0], &port);
+  FREGetObjectAsUTF8(argv[1], &address_length, (const uint8_t**)&address);
+  
+  // Attempt to bind the socket to the port and interface
+  pthread_mutex_lock(&ctxdata->reactor->lock);
+  int error = open_listener(listener, port, address);
+  port = listener->port;
+  pthread_mutex_unlock(&ctxdata->reactor->lock);
+  if (error < 0) goto ServerSocketBindError;
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  
+  // Set the success property
+  FREObject fre_success;
+  FRENewObjectFromBool(true, &fre_success);
+  FRESetObjectProperty(object, (const uint8_t*)"success", fre_success, NULL);
+  
+  // Set the port property
+  FREObject fre_port;
+  FRENewObjectFromInt32(port, &fre_port);
+  FRESetObjectProperty(object, (const uint8_t*)"localPort", fre_port, NULL);
+  
+  return object;
+  
+ServerSocketBindError:
+  generate_error(&object);
+  return object;
+}
+
+FREObject ServerSocketListen(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  listener_data* listener = &ctxdata->listeners[0];
+  if (listener->socket_fd < 0) return NULL;
+  if (listener->is_listening == true) return NULL;
+  
+  // Get the backlog and the optional low latency options from the AS layer
+  int backlog = 0;
+  FREGetObjectAsInt32(argv[0], &backlog);
+  FREObject options = argc > 1 ? argv[1] : NULL;
+  
+  // Start the reactor and tune its thread, then start listening, the reactor picks the socket up on its next pass
+  pthread_mutex_lock(&ctxdata->reactor->lock);
+  int error = start_reactor(ctxdata->reactor);
+  if (error == 0) error = apply_listen_options(ctxdata, options);
+  if (error != 0) { errno = error; error = -1; }
+  else {
+    get_bool_option(options, "http", &listener->is_http);
+    error = start_listener(ctxdata, listener, backlog);
+  }
+  pthread_mutex_unlock(&ctxdata->reactor->lock);
+  if (error < 0) goto ServerSocketListenError;
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  
+  // Set the success property
+  FREObject fre_success;
+  FRENewObjectFromBool(true, &fre_success);
+  FRESetObjectProperty(object, (const uint8_t*)"success", fre_success, NULL);
+  
+  return object;
+  
+ServerSocketListenError:
+  generate_error(&object);
+  return object;
+}
+
+/* send(socketIndex:int, data:ByteArray, priority:int, end:Boolean):int
+ * Queue data in one of the priority classes of a socket, end marks the last piece of a message.
+ * Data the memory budget can not cover is refused as a whole, the AS layer keeps it and tries again later.
+ * return - the number of bytes queued
+ */
+FREObject ServerSocketSend(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  // Read the socket_index from the AS layer
+  int socket_index = 0;
+  FREGetObjectAsInt32(argv[0], &socket_index);
+  
+  // Accquire our byte array from the AS layer
+  FREByteArray byte_array;
+  FREAcquireByteArray(argv[1], &byte_array);
+  int length = byte_array.length;
+  
+  // Read the class and message boundary, sends without them are whole normal messages
+  int priority = SS_PRIORITY_NORMAL;
+  uint32_t end = 1;
+  if (argc > 2) FREGetObjectAsInt32(argv[2], &priority);
+  if (argc > 3) FREGetObjectAsBool(argv[3], &end);
+  
+  // Write the data to our sockets queue, stamping it first if we are tracing
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  int index = 0;
+  ss_socket* socket = find_socket(ctxdata, socket_index, &index);
+  // HTTP responses have to go out in request order, so they all share the normal class
+  if (socket != NULL && socket->http != NULL) priority = SS_PRIORITY_NORMAL;
+  
+  // Data that fits in memory the queue already holds is always taken, even over the budget
+  int growth = socket != NULL ? ss_send_queue_growth(&socket->send_queue, (ss_priority)priority, length) : 0;
+  if (socket != NULL && socket->state != SS_SOCKET_CLOSING && growth > 0 && ss_budget_exhausted(&ctxdata->budget, growth)) {
+    // Refuse what the budget can not cover, before anything about the socket changes
+    length = 0;
+  }
+  else if (socket != NULL && socket->state != SS_SOCKET_CLOSING) {
+    bool was_idle = ss_send_queue_ready(&socket->send_queue, &ctxdata->send_policy, socket->socket_desc, NULL) == false;
+    if (socket->http == NULL) ss_trace_push(&socket->send_trace, ss_trace_enabled() ? ss_clock_ns() : 0, 0, length);
+    ss_send_queue_write(&socket->send_queue, (ss_priority)priority, byte_array.bytes, length, end != 0);
+    
+    // A send on an HTTP socket is the response to the request the AS layer holds, close the connection if the client
+    // asked us to, otherwise move on to any requests that were pipelined behind it
+    if (socket->http != NULL && socket->http->awaiting_response) {
+      pthread_mutex_lock(&socket->read_buffer.lock);
+      socket->http->awaiting_response = false;
+      socket->http->started = ss_clock_ns();
+      if (socket->http->respond_keep_alive == false) {
+        socket->notify_close = true;
+        socket->state = SS_SOCKET_CLOSING;
+      }
+      pthread_mutex_unlock(&socket->read_buffer.lock);
+      advance_http(ctxdata, index, socket);
+      was_idle = true;
+    }
+    
+    // Let the reactor know it has something to send
+    if (was_idle && socket->state != SS_SOCKET_CONNECTING) wake_reactor(ctxdata->reactor);
+  }
+  else {
+    length = 0;
+  }
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
+  
+  // Release our byte array back to the AS layer
+  FREReleaseByteArray(argv[1]);
+  
+  // Return the number of bytes sent
+  FREObject fre_length;
+  FRENewObjectFromInt32(length, &fre_length);
+  return fre_length;
+}
+
+FREObject ServerSocketRecv(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  // Read the socket_index from the AS layer
+  int socket_index = 0;
+  FREGetObjectAsInt32(argv[0], &socket_index);
+  
+  // Read the data offset from the AS layer
+  int offset = 0;
+  FREGetObjectAsInt32(argv[2], &offset);
+  
+  // Read the data length from the AS layer
+  int length = 0;
+  FREGetObjectAsInt32(argv[3], &length);
+  
+  // Accquire our byte array from the AS layer
+  FREByteArray byte_array;
+  FREAcquireByteArray(argv[1], &byte_array);
+  
+  // Read the data from our buffer
+  int actual_length = 0;
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  ss_socket* socket = find_socket(ctxdata, socket_index, NULL);
+  if (socket != NULL) {
+    actual_length = ss_read(&socket->read_buffer, &byte_array.bytes[offset], length);
+    ss_trace_consume(&socket->recv_trace, actual_length, SS_TRACE_DISPATCH_TO_READ, SS_TRACE_REACTOR_TO_READ);
+  }
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
+  
+  // Release our byte array back to the AS layer
+  FREReleaseByteArray(argv[1]);
+  
+  // Return the number of bytes read
+  FREObject fre_length;
+  FRENewObjectFromInt32(actual_length, &fre_length);
+  return fre_length;
+}
+
+/* startCapture(path:String, size:int):void
+ * Start capturing accepts, closes and socket data for every context into a ring file for later replay
+ * return - result object
+ */
+FREObject ServerSocketStartCapture(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  
+  // Read the capture path from the AS layer
+  uint32_t path_length = 0;
+  const uint8_t* path = NULL;
+  FREGetObjectAsUTF8(argv[0], &path_length, &path);
+  
+  // Read the ring size from the AS layer
+  int size = SS_CAPTURE_DEFAULT_SIZE;
+  FREGetObjectAsInt32(argv[1], &size);
+  if (size <= 0) size = SS_CAPTURE_DEFAULT_SIZE;
+  
+  // Open the capture file
+  if (path == NULL || ss_capture_open((const char*)path, (unsigned int)size) == false) goto ServerSocketStartCaptureError;
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  
+  // Set the success property
+  FREObject fre_success;
+  FRENewObjectFromBool(true, &fre_success);
+  FRESetObjectProperty(object, (const uint8_t*)"success", fre_success, NULL);
+  
+  return object;
+  
+ServerSocketStartCaptureError:
+  generate_error(&object);
+  return object;
+}
+
+/* stopCapture():void
+ * Stop a running capture and flush it to disk
+ */
+FREObject ServerSocketStopCapture(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  ss_capture_close();
+  return NULL;
+}
+
+/* startTrace():void
+ * Start timestamping chunks of data at every stage between the kernel and the AS layer, clearing any previous results
+ */
+FREObject ServerSocketStartTrace(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  ss_trace_start();
+  if (ctxdata == NULL) return NULL;
+  
+  // Tracing is shared, so have the kernel timestamp the sockets every context already has open
+  int i = 0;
+  reactor_data* reactor = ctxdata->reactor;
+  pthread_mutex_lock(&reactor->lock);
+  for (ctxdata = reactor->contexts; ctxdata != NULL; ctxdata = ctxdata->next) {
+    pthread_mutex_lock(&ctxdata->sockets_lock);
+    for (i = 0; i < SOMAXCONN; ++i) {
+      if (ctxdata->sockets[i] != NULL) ss_trace_enable_socket(ctxdata->sockets[i]->socket_desc);
+    }
+    pthread_mutex_unlock(&ctxdata->sockets_lock);
+  }
+  pthread_mutex_unlock(&reactor->lock);
+  
+  return NULL;
+}
+
+/* stopTrace():void
+ * Stop timestamping chunks of data, the results are kept until the next startTrace
+ */
+FREObject ServerSocketStopTrace(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  ss_trace_stop();
+  return NULL;
+}
+
+/* traceStats(reset:Boolean = false):Object
+ * Export the latency histogram of every traced stage
+ * return - object with a property per stage, each holding the count and the mean, p50, p90, p99, p999 and max in microseconds
+ */
+FREObject ServerSocketTraceStats(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  int stage = 0;
   
-  // Disconnect everyone and free up our sockets
-  for (s = NULL, i = 0; i < SOMAXCONN; ++i) {
-    s = ctxdata->sockets[i]; if (s == NULL) continue;
-    close(s->socket_desc);
-    ss_free(s);
+  // Read the reset flag from the AS layer
+  uint32_t reset = 0;
+  if (argc > 0) FREGetObjectAsBool(argv[0], &reset);
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  
+  // Summarize each stage
+  for (stage = 0; stage < SS_TRACE_STAGE_COUNT; ++stage) {
+    const ss_histogram* histogram = ss_trace_histogram(stage);
+    
+    FREObject fre_stage;
+    FRENewObject((const uint8_t*)"Object", 0, NULL, &fre_stage, NULL);
+    set_number_property(fre_stage, "count", (double)histogram->total);
+    set_number_property(fre_stage, "mean", histogram->total > 0 ? histogram->sum / (double)histogram->total / 1000.0 : 0);
+    set_number_property(fre_stage, "p50", ss_histogram_percentile(histogram, 50.0) / 1000.0);
+    set_number_property(fre_stage, "p90", ss_histogram_percentile(histogram, 90.0) / 1000.0);
+    set_number_property(fre_stage, "p99", ss_histogram_percentile(histogram, 99.0) / 1000.0);
+    set_number_property(fre_stage, "p999", ss_histogram_percentile(histogram, 99.9) / 1000.0);
+    set_number_property(fre_stage, "max", histogram->max / 1000.0);
+    FRESetObjectProperty(object, (const uint8_t*)ss_trace_stage_name(stage), fre_stage, NULL);
   }
   
-  // Dispatch SocketShutdown Status Event, letting the AS layer know that the server closed and all sockets are invalid
-  #pragma mark StatusEvent -> SocketShutdown
-  FREDispatchStatusEventAsync(ctxdata->ctx, (const uint8_t*)"SocketShutdown", (const uint8_t*)"");
+  if (reset) ss_trace_reset();
   
-  return NULL;
+  return object;
 }
 
-/* ServerSocketExtInitializer()
- * The extension initializer is called the first time the ActionScript side of the extension
- * calls ExtensionContext.createExtensionContext() for any context.
- *
- * Please note: this should be same as the <initializer> specified in the extension.xml
+/* admission(addressRate:Number, addressBurst:int, globalRate:Number, globalBurst:int):void
+ * Limit the rate incoming connections are accepted at, per source address and overall, a rate of 0 removes the limit
  */
-void ServerSocketExtInitializer(void** extDataToSet, FREContextInitializer* ctxInitializerToSet, FREContextFinalizer* ctxFinalizerToSet)
+FREObject ServerSocketAdmission(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
-  *extDataToSet = NULL;
-  *ctxInitializerToSet = &ServerSocketContextInitializer;
-  *ctxFinalizerToSet = &ServerSocketContextFinalizer;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  // Read the limits from the AS layer
+  double address_rate = 0, global_rate = 0;
+  int address_burst = 0, global_burst = 0;
+  FREGetObjectAsDouble(argv[0], &address_rate);
+  FREGetObjectAsInt32(argv[1], &address_burst);
+  FREGetObjectAsDouble(argv[2], &global_rate);
+  FREGetObjectAsInt32(argv[3], &global_burst);
+  
+  ss_admission_configure(&ctxdata->admission, address_rate, address_burst, global_rate, global_burst);
+  
+  return NULL;
 }
 
-/* ServerSocketExtFinalizer()
- * The extension finalizer is called when the runtime unloads the extension. However, it may not always called.
- *
- * Please note: this should be same as the <finalizer> specified in the extension.xml
+/* memoryBudget(limit:Number, idleTimeout:int):void
+ * Cap the memory all socket buffers of this context may hold (0 for no limit), and set how long a buffer
+ * must be quiet before it is shrunk back down to fit its contents
  */
-void ServerSocketExtFinalizer(void* extData)
+FREObject ServerSocketMemoryBudget(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  // Read the limit from the AS layer
+  double limit = 0;
+  FREGetObjectAsDouble(argv[0], &limit);
+  if (limit < 0) limit = 0;
+  
+  // Read the idle timeout from the AS layer
+  int idle_timeout = SS_BUDGET_IDLE_MS;
+  FREGetObjectAsInt32(argv[1], &idle_timeout);
+  if (idle_timeout < 0) idle_timeout = 0;
   
+  ctxdata->budget.limit = (int64_t)limit;
+  ctxdata->budget.idle_ns = (uint64_t)idle_timeout * 1000000ULL;
+  
+  return NULL;
 }
 
-/* ContextInitializer()
- * The context initializer is called when the runtime creates the extension context instance.
+/* memoryUsage():Object
+ * Report the memory held by the socket buffers of this context
+ * return - object with the used, peak and limit bytes, and the number of open sockets
  */
-void ServerSocketContextInitializer(void* extData, const uint8_t* ctxType, FREContext ctx, uint32_t* numFunctionsToTest, const FRENamedFunction** functionsToSet)
-{  
-  // Initialize our context data
-  context_data* ctxdata = context_data_alloc();
-  ctxdata->ctx = ctx;
-  FRESetContextNativeData(ctx, ctxdata);
+FREObject ServerSocketMemoryUsage(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
+  
+  // Count the open sockets
+  int i = 0, sockets = 0;
+  for (i = 0; i < SOMAXCONN; ++i) {
+    if (ctxdata->sockets[i] != NULL) sockets++;
+  }
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  set_number_property(object, "used", (double)ctxdata->budget.used);
+  set_number_property(object, "peak", (double)ctxdata->budget.peak);
+  set_number_property(object, "limit", (double)ctxdata->budget.limit);
+  set_number_property(object, "sockets", sockets);
+  
+  return object;
+}
 
+/* connect(host:String, port:int):Object
+ * Open an outbound connection on the reactor thread, reusing a pooled connection to the same destination if there is one.
+ * The connect completes in the background with a SocketConnected or SocketConnectError event.
+ * return - result object, with the index of the new socket
+ */
+FREObject ServerSocketConnect(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
   
-  /* The following code describes the functions that are exposed by this native extension to the ActionScript code.
-   * As a sample, the function isSupported is being provided.
-   */
-  *numFunctionsToTest = 5;
+  int i = 0, error = 0, socket_fd = -1, handle = -1;
+  ss_socket* s = NULL;
   
-  FRENamedFunction* func = (FRENamedFunction*) malloc(sizeof(FRENamedFunction) * (*numFunctionsToTest));
+  // Read the values from the AS layer
+  uint32_t host_length = 0;
+  const uint8_t* host = NULL;
+  int port = 0;
+  FREGetObjectAsUTF8(argv[0], &host_length, &host);
+  FREGetObjectAsInt32(argv[1], &port);
+  if (host == NULL) { errno = EINVAL; goto ServerSocketConnectError; }
   
-  func[0].name = (const uint8_t*) "close";
-  func[0].functionData = NULL;
-  func[0].function = &ServerSocketClose;
+  // Build the destination address
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
   
-  func[1].name = (const uint8_t*) "bind";
-  func[1].functionData = NULL;
-  func[1].function = &ServerSocketBind;
-    
-  func[2].name = (const uint8_t*) "listen";
-  func[2].functionData = NULL;
-  func[2].function = &ServerSocketListen;
+  // Resolve host names, this is the one part of connect that blocks the caller
+  if (inet_pton(AF_INET, (const char*)host, &address.sin_addr) != 1) {
+    struct addrinfo hints, *info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo((const char*)host, NULL, &hints, &info) != 0 || info == NULL) { errno = EHOSTUNREACH; goto ServerSocketConnectError; }
+    address.sin_addr = ((struct sockaddr_in *)info->ai_addr)->sin_addr;
+    freeaddrinfo(info);
+  }
   
-  func[3].name = (const uint8_t*) "send";
-  func[3].functionData = NULL;
-  func[3].function = &ServerSocketSend;
+  // Do not start new connections the memory budget can not cover
+  if (ss_budget_exhausted(&ctxdata->budget, 2 * SS_BUFFER_SIZE)) { errno = ENOBUFS; goto ServerSocketConnectError; }
   
-  func[4].name = (const uint8_t*) "recv";
-  func[4].functionData = NULL;
-  func[4].function = &ServerSocketRecv;
+  // Make sure the reactor is running to complete the connect
+  pthread_mutex_lock(&ctxdata->reactor->lock);
+  error = start_reactor(ctxdata->reactor);
+  pthread_mutex_unlock(&ctxdata->reactor->lock);
+  if (error != 0) { errno = error; goto ServerSocketConnectError; }
   
-  *functionsToSet = func;
+  // Reuse a pooled connection or start a new one
+  socket_fd = ss_pool_take(&ctxdata->pool, &address);
+  if (socket_fd < 0) socket_fd = ss_connect(&address);
+  if (socket_fd < 0) goto ServerSocketConnectError;
+  
+  // Find a home for this connection, pooled connections go through the connect check too so they report the same way
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  for (i = 0; i < SOMAXCONN; ++i) {
+    if (ctxdata->sockets[i] == NULL) break;
+  }
+  if (i < SOMAXCONN) {
+    s = ss_alloc(socket_fd, &ctxdata->budget);
+    s->state = SS_SOCKET_CONNECTING;
+    s->is_outbound = true;
+    s->remote_address = address;
+    ctxdata->sockets[i] = s;
+    handle = socket_handle(ctxdata, i);
+  }
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
+  
+  if (s == NULL) { close(socket_fd); errno = EMFILE; goto ServerSocketConnectError; }
+  if (ss_trace_enabled()) ss_trace_enable_socket(socket_fd);
+  if (ctxdata->socket_busy_poll > 0) ss_busy_poll(socket_fd, ctxdata->socket_busy_poll);
+  wake_reactor(ctxdata->reactor);
+  
+  // Create the return object
+  FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  
+  // Set the success property
+  FREObject fre_success;
+  FRENewObjectFromBool(true, &fre_success);
+  FRESetObjectProperty(object, (const uint8_t*)"success", fre_success, NULL);
+  
+  // Set the index property, the handle the AS layer knows the socket by
+  FREObject fre_index;
+  FRENewObjectFromInt32(handle, &fre_index);
+  FRESetObjectProperty(object, (const uint8_t*)"index", fre_index, NULL);
+  
+  return object;
+  
+ServerSocketConnectError:
+  generate_error(&object);
+  return object;
 }
 
-/* ContextFinalizer()
- * The context finalizer is called when the extension's ActionScript code
- * calls the ExtensionContext instance's dispose() method.
- * If the AIR runtime garbage collector disposes of the ExtensionContext instance, the runtime also calls ContextFinalizer().
+/* closeSocket(socketIndex:int, keepAlive:Boolean):void
+ * Close a socket once its pending data is flushed, keep alive outbound connections are parked in the connection pool
  */
-void ServerSocketContextFinalizer(FREContext ctx)
+FREObject ServerSocketCloseSocket(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
-  if (ctxdata == NULL) return;
+  if (ctxdata == NULL) return NULL;
   
-  // Shutdown the server
-  ServerSocketClose(ctx, NULL, 0, NULL);
+  // Read the values from the AS layer
+  int socket_index = 0;
+  uint32_t keep_alive = 0;
+  FREGetObjectAsInt32(argv[0], &socket_index);
+  FREGetObjectAsBool(argv[1], &keep_alive);
   
-  // Cleanup our context data
-  context_data_free(ctxdata);
-  FRESetContextNativeData(ctx, NULL);
+  // Hand the socket over to the reactor to flush and release, only a fully connected socket can be kept alive
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  ss_socket* socket = find_socket(ctxdata, socket_index, NULL);
+  if (socket != NULL && socket->state != SS_SOCKET_CLOSING) {
+    socket->keep_alive = keep_alive && socket->state == SS_SOCKET_CONNECTED;
+    socket->state = SS_SOCKET_CLOSING;
+    ss_send_queue_end(&socket->send_queue);
+  }
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
+  
+  wake_reactor(ctxdata->reactor);
+  
+  return NULL;
 }
 
-FREObject ServerSocketClose(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+/* connectionPool(maxIdlePerDestination:int, idleTimeout:int):void
+ * Keep up to maxIdlePerDestination closed keep alive connections per destination for reuse, for idleTimeout milliseconds
+ */
+FREObject ServerSocketConnectionPool(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
   if (ctxdata == NULL) return NULL;
-  if (ctxdata->is_listening == false) return NULL;
   
-  // Shutdown the listening thread
-  ctxdata->is_listening = false;
-  pthread_join(ctxdata->server_thread, NULL);
+  // Read the values from the AS layer
+  int max_per_destination = 0, idle_timeout = SS_POOL_IDLE_MS;
+  FREGetObjectAsInt32(argv[0], &max_per_destination);
+  FREGetObjectAsInt32(argv[1], &idle_timeout);
   
-  // Free the context data
-  context_data_free(ctxdata);
-  FRESetContextNativeData(ctx, NULL);
+  ss_pool_configure(&ctxdata->pool, max_per_destination, idle_timeout);
   
   return NULL;
 }
 
-/* bind(localPort:int = 0, localAddress:String = "0.0.0.0"):void
- * Bind to the local port and local address passed in from AS
- * return - result object
+/* addListener(localPort:int, localAddress:String, backlog:int, options:Object):Object
+ * Bind and listen on another port, connections from every listener of the context arrive as SocketOpened events.
+ * Takes the same options as listen.
+ * return - result object, with the port we bound to
  */
-FREObject ServerSocketBind(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+FREObject ServerSocketAddListener(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
   FREObject object = NULL;
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
   if (ctxdata == NULL) return NULL;
-  if (ctxdata->is_bound == true) return NULL;
-  
-  int opt_val = 1; // YES
-  int error = 0;
-  
-  // Create the socket file descriptor
-  ctxdata->server_socket_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (ctxdata->server_socket_fd < 0) goto ServerSocketBindError;
-  
-  // Set the socket up for reuse
-  setsockopt(ctxdata->server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
   
-  // Set our server socket to non-blocking
-  error = fcntl(ctxdata->server_socket_fd, F_SETFL, O_NONBLOCK);
-  if (error < 0) goto ServerSocketBindError;
+  int i = 0, error = 0, port = 0, backlog = 0;
+  listener_data* listener = NULL;
   
   // Read the values from the AS layer
-  int port = 0;
   uint32_t address_length = 0;
   const char* address = NULL;
   FREGetObjectAsInt32(argv[0], &port);
   FREGetObjectAsUTF8(argv[1], &address_length, (const uint8_t**)&address);
+  FREGetObjectAsInt32(argv[2], &backlog);
+  FREObject options = argc > 3 ? argv[3] : NULL;
   
-  // Setup the sockaddr_in structure with the port and address
-  memset(&ctxdata->server_sockaddr, 0, sizeof(ctxdata->server_sockaddr));
-  ctxdata->server_sockaddr.sin_family = AF_INET;
-  ctxdata->server_sockaddr.sin_port = htons(port);
+  pthread_mutex_lock(&ctxdata->reactor->lock);
   
-  // Bind to any, or bind to a specific address if provided
-  if (strcmp(address, "0.0.0.0") == 0) {
-    ctxdata->server_sockaddr.sin_addr.s_addr = INADDR_ANY;
+  // Find a free listener, the first one belongs to bind and listen
+  for (i = 1; i < SS_MAX_LISTENERS; ++i) {
+    if (ctxdata->listeners[i].socket_fd < 0) { listener = &ctxdata->listeners[i]; break; }
   }
-  else {
-    inet_pton(AF_INET, address, &(ctxdata->server_sockaddr.sin_addr));
-  }
-  
-  // Attempt to bind the socket to the port and interface
-  error = bind(ctxdata->server_socket_fd, (struct sockaddr *)&ctxdata->server_sockaddr, sizeof(ctxdata->server_sockaddr));
-  if (error < 0) goto ServerSocketBindError;
+  if (listener == NULL) { errno = EMFILE; error = -1; }
   
-  ctxdata->is_bound = true;
+  // Bind, apply the options and start listening
+  if (error == 0) error = open_listener(listener, port, address);
+  if (error == 0) {
+    error = start_reactor(ctxdata->reactor);
+    if (error == 0) error = apply_listen_options(ctxdata, options);
+    if (error != 0) { errno = error; error = -1; }
+    else {
+      get_bool_option(options, "http", &listener->is_http);
+      error = start_listener(ctxdata, listener, backlog);
+    }
+    if (error < 0) { port = errno; close_listener(listener); errno = port; }
+  }
+  if (error == 0) port = listener->port;
   
-  // Get the port that we just bound to
-  struct sockaddr_in sin;
-  socklen_t len = sizeof(sin);
-  if (getsockname(ctxdata->server_socket_fd, (struct sockaddr *)&sin, &len) == -1) goto ServerSocketBindError;
-  port = ntohs(sin.sin_port);
+  pthread_mutex_unlock(&ctxdata->reactor->lock);
+  if (error < 0) goto ServerSocketAddListenerError;
   
   // Create the return object
   FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
@@ -388,110 +1744,229 @@ FREObject ServerSocketBind(FREContext ctx, void* funcData, uint32_t argc, FREObj
   
   return object;
   
-ServerSocketBindError:
+ServerSocketAddListenerError:
   generate_error(&object);
   return object;
 }
 
-FREObject ServerSocketListen(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+/* removeListener(localPort:int):void
+ * Stop listening on a port added with addListener, connections already accepted from it stay open
+ */
+FREObject ServerSocketRemoveListener(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
-  FREObject object = NULL;
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
   if (ctxdata == NULL) return NULL;
   
-  if (ctxdata->is_bound == false) return NULL;
-  if (ctxdata->is_listening == true) return NULL;
+  int i = 0, port = 0;
+  FREGetObjectAsInt32(argv[0], &port);
   
-  // Get the backlog from the AS layer
-  int backlog = 0;
-  FREGetObjectAsInt32(argv[0], &backlog);
+  // Close the listener, then wake the reactor so it does not select on the closed socket for long
+  pthread_mutex_lock(&ctxdata->reactor->lock);
+  for (i = 1; i < SS_MAX_LISTENERS; ++i) {
+    if (ctxdata->listeners[i].socket_fd >= 0 && ctxdata->listeners[i].port == port) close_listener(&ctxdata->listeners[i]);
+  }
+  pthread_mutex_unlock(&ctxdata->reactor->lock);
+  wake_reactor(ctxdata->reactor);
   
-  // Correct the backlog
-  if (backlog > SOMAXCONN) backlog = SOMAXCONN;
+  return NULL;
+}
 
-  // Open the socket for listening
-  int error = listen(ctxdata->server_socket_fd, backlog);
-  if (error < 0) goto ServerSocketListenError;
+/* reactorStats(reset:Boolean = false):Object
+ * Report what the shared reactor thread has cost since the last reset
+ * return - object with the cpu and wall time in milliseconds, the cpu utilization, and the number of polls and sleeps
+ */
+FREObject ServerSocketReactorStats(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  FREObject object = NULL;
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
   
-  // Create the connection handler thread, this thread will mark the context as listening when it starts
-  error = pthread_create(&ctxdata->server_thread, NULL, serverListeningThread, (void *)ctxdata);
-  if (error < 0) goto ServerSocketListenError;
+  reactor_data* reactor = ctxdata->reactor;
+  
+  // Read the reset flag from the AS layer
+  uint32_t reset = 0;
+  if (argc > 0) FREGetObjectAsBool(argv[0], &reset);
+  
+  pthread_mutex_lock(&reactor->lock);
+  uint64_t now = ss_clock_ns();
+  double cpu = (double)(reactor->cpu_ns - reactor->base_cpu_ns) / 1000000.0;
+  double wall = (double)(now - reactor->base_time) / 1000000.0;
   
   // Create the return object
   FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+  set_number_property(object, "cpu", cpu);
+  set_number_property(object, "wall", wall);
+  set_number_property(object, "utilization", wall > 0 ? cpu / wall : 0);
+  set_number_property(object, "polls", (double)(reactor->polls - reactor->base_polls));
+  set_number_property(object, "sleeps", (double)(reactor->sleeps - reactor->base_sleeps));
+  set_number_property(object, "busyPoll", reactor->spin_ns / 1000.0);
   
-  // Set the success property
-  FREObject fre_success;
-  FRENewObjectFromBool(true, &fre_success);
-  FRESetObjectProperty(object, (const uint8_t*)"success", fre_success, NULL);
-  
-  return object;
+  if (reset) {
+    reactor->base_cpu_ns = reactor->cpu_ns;
+    reactor->base_polls = reactor->polls;
+    reactor->base_sleeps = reactor->sleeps;
+    reactor->base_time = now;
+  }
+  pthread_mutex_unlock(&reactor->lock);
   
-ServerSocketListenError:
-  generate_error(&object);
   return object;
 }
 
-FREObject ServerSocketSend(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+/* httpRequest(socketIndex:int, body:ByteArray):Object
+ * Take the request announced by an HttpRequest event, the body is written into the byte array passed in.
+ * The next send on the socket is the response, after which requests pipelined behind this one are picked up.
+ * return - object with the method, path, version, headers (by lower case name), and keepAlive, or null if no request is waiting
+ */
+FREObject ServerSocketHttpRequest(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
+  FREObject object = NULL;
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
   if (ctxdata == NULL) return NULL;
   
+  int i = 0, j = 0;
+  char name[256];
+  
   // Read the socket_index from the AS layer
   int socket_index = 0;
   FREGetObjectAsInt32(argv[0], &socket_index);
   
-  // Accquire our byte array from the AS layer
-  FREByteArray byte_array;
-  FREAcquireByteArray(argv[1], &byte_array);
-  int length = byte_array.length;
-  
-  // Write the data to our sockets buffer
-  ss_socket* socket = ctxdata->sockets[socket_index];
-  ss_write(&socket->write_buffer, byte_array.bytes, length);
+  pthread_mutex_lock(&ctxdata->sockets_lock);
+  ss_socket* socket = find_socket(ctxdata, socket_index, NULL);
+  if (socket == NULL || socket->http == NULL) {
+    pthread_mutex_unlock(&ctxdata->sockets_lock);
+    return NULL;
+  }
   
-  // Release our byte array back to the AS layer
-  FREReleaseByteArray(argv[1]);
+  ss_http_request* request = socket->http;
+  pthread_mutex_lock(&socket->read_buffer.lock);
+  if (request->state == SS_HTTP_STATE_DONE && request->awaiting_response == false) {
+    const unsigned char* data = socket->read_buffer.buffer;
+    FREObject fre_value, fre_headers;
+    
+    // Create the return object, with the request line
+    FRENewObject((const uint8_t*)"Object", 0, NULL, &object, NULL);
+    FRENewObjectFromUTF8(request->method.length, &data[request->method.offset], &fre_value);
+    FRESetObjectProperty(object, (const uint8_t*)"method", fre_value, NULL);
+    FRENewObjectFromUTF8(request->path.length, &data[request->path.offset], &fre_value);
+    FRESetObjectProperty(object, (const uint8_t*)"path", fre_value, NULL);
+    FRENewObjectFromUTF8(request->version.length, &data[request->version.offset], &fre_value);
+    FRESetObjectProperty(object, (const uint8_t*)"version", fre_value, NULL);
+    FRENewObjectFromBool(request->keep_alive, &fre_value);
+    FRESetObjectProperty(object, (const uint8_t*)"keepAlive", fre_value, NULL);
+    
+    // Headers by lower case name, repeated headers are joined with commas
+    FRENewObject((const uint8_t*)"Object", 0, NULL, &fre_headers, NULL);
+    for (i = 0; i < request->header_count; ++i) {
+      ss_http_span name_span = request->header_names[i], value_span = request->header_values[i];
+      if (name_span.length >= sizeof(name)) continue;
+      for (j = 0; j < (int)name_span.length; ++j) {
+        char c = (char)data[name_span.offset + j];
+        name[j] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+      }
+      name[name_span.length] = '\0';
+      
+      uint32_t existing_length = 0;
+      const uint8_t* existing = NULL;
+      FREObject fre_existing = NULL;
+      if (FREGetObjectProperty(fre_headers, (const uint8_t*)name, &fre_existing, NULL) == FRE_OK && fre_existing != NULL
+          && FREGetObjectAsUTF8(fre_existing, &existing_length, &existing) == FRE_OK) {
+        char* joined = malloc(existing_length + 2 + value_span.length);
+        memcpy(joined, existing, existing_length);
+        memcpy(&joined[existing_length], ", ", 2);
+        memcpy(&joined[existing_length + 2], &data[value_span.offset], value_span.length);
+        FRENewObjectFromUTF8(existing_length + 2 + value_span.length, (const uint8_t*)joined, &fre_value);
+        free(joined);
+      }
+      else {
+        FRENewObjectFromUTF8(value_span.length, &data[value_span.offset], &fre_value);
+      }
+      FRESetObjectProperty(fre_headers, (const uint8_t*)name, fre_value, NULL);
+    }
+    FRESetObjectProperty(object, (const uint8_t*)"headers", fre_headers, NULL);
+    
+    // Copy the body straight from the read buffer into the byte array
+    if (argc > 1 && request->body.length > 0) {
+      FREObject fre_length;
+      FREByteArray byte_array;
+      FRENewObjectFromUint32(request->body.length, &fre_length);
+      FRESetObjectProperty(argv[1], (const uint8_t*)"length", fre_length, NULL);
+      if (FREAcquireByteArray(argv[1], &byte_array) == FRE_OK) {
+        memcpy(byte_array.bytes, &data[request->body.offset], request->body.length < byte_array.length ? request->body.length : byte_array.length);
+        FREReleaseByteArray(argv[1]);
+      }
+    }
+    
+    // Drop the request from the buffer and hold later requests until the AS layer responds
+    bool keep_alive = request->keep_alive;
+    consume_buffer(&socket->read_buffer, request->length);
+    ss_http_reset(request);
+    request->awaiting_response = true;
+    request->respond_keep_alive = keep_alive;
+  }
+  pthread_mutex_unlock(&socket->read_buffer.lock);
+  pthread_mutex_unlock(&ctxdata->sockets_lock);
   
-  // Return the number of bytes sent
-  FREObject fre_length;
-  FRENewObjectFromInt32(length, &fre_length);
-  return fre_length;
+  return object;
 }
 
-FREObject ServerSocketRecv(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+/* httpCache(path:String, response:ByteArray):Boolean
+ * Serve a pre-serialized response (status line, headers and body) to GET requests for the path straight from the IO thread,
+ * a null response removes the path from the cache
+ * return - false if the cache is full
+ */
+FREObject ServerSocketHttpCache(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
 {
   context_data* ctxdata = NULL;
   FREGetContextNativeData(ctx, (void**)&ctxdata);
   if (ctxdata == NULL) return NULL;
   
-  // Read the socket_index from the AS layer
-  int socket_index = 0;
-  FREGetObjectAsInt32(argv[0], &socket_index);
-  
-  // Read the data offset from the AS layer
-  int offset = 0;
-  FREGetObjectAsInt32(argv[2], &offset);
+  bool stored = false;
   
-  // Read the data length from the AS layer
-  int length = 0;
-  FREGetObjectAsInt32(argv[3], &length);
+  // Read the path from the AS layer
+  uint32_t path_length = 0;
+  const uint8_t* path = NULL;
+  FREGetObjectAsUTF8(argv[0], &path_length, &path);
   
-  // Accquire our byte array from the AS layer
+  // Cache or remove the response
   FREByteArray byte_array;
-  FREAcquireByteArray(argv[1], &byte_array);
+  if (path != NULL && argc > 1 && argv[1] != NULL && FREAcquireByteArray(argv[1], &byte_array) == FRE_OK) {
+    stored = ss_http_cache_put(&ctxdata->http_cache, (const char*)path, byte_array.bytes, byte_array.length);
+    FREReleaseByteArray(argv[1]);
+  }
+  else if (path != NULL) {
+    stored = ss_http_cache_put(&ctxdata->http_cache, (const char*)path, NULL, 0);
+  }
   
-  // Read the data from our buffer
-  ss_socket* socket = ctxdata->sockets[socket_index];
-  int actual_length = ss_read(&socket->read_buffer, &byte_array.bytes[offset], length);
+  FREObject fre_stored;
+  FRENewObjectFromBool(stored, &fre_stored);
+  return fre_stored;
+}
+
+/* sendScheduling(strict:Boolean, controlWeight:int, normalWeight:int, bulkWeight:int, bulkInFlight:int):void
+ * Choose how the priority classes of every socket share the link, strictly by priority or by weight,
+ * and how many bulk bytes may wait in the kernel at once (0 for no limit)
+ */
+FREObject ServerSocketSendScheduling(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[])
+{
+  context_data* ctxdata = NULL;
+  FREGetContextNativeData(ctx, (void**)&ctxdata);
+  if (ctxdata == NULL) return NULL;
   
-  // Release our byte array back to the AS layer
-  FREReleaseByteArray(argv[1]);
+  // Read the values from the AS layer
+  uint32_t strict = 0;
+  int control_weight = 0, normal_weight = 0, bulk_weight = 0, bulk_in_flight = 0;
+  FREGetObjectAsBool(argv[0], &strict);
+  FREGetObjectAsInt32(argv[1], &control_weight);
+  FREGetObjectAsInt32(argv[2], &normal_weight);
+  FREGetObjectAsInt32(argv[3], &bulk_weight);
+  FREGetObjectAsInt32(argv[4], &bulk_in_flight);
   
-  // Return the number of bytes read
-  FREObject fre_length;
-  FRENewObjectFromInt32(actual_length, &fre_length);
-  return fre_length;
+  // The reactor picks the new policy up on its next flush, wake it in case bulk data was being held back
+  ss_send_policy_configure(&ctxdata->send_policy, strict != 0, control_weight, normal_weight, bulk_weight, bulk_in_flight);
+  wake_reactor(ctxdata->reactor);
+  
+  return NULL;
 }
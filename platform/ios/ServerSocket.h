@@ -31,6 +31,7 @@
 #include <sys/fcntl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,33 +42,106 @@
 
 #include "FlashRuntimeExtensions.h"
 #include "ss_socket.h"
+#include "ss_capture.h"
+#include "ss_trace.h"
+#include "ss_admission.h"
+#include "ss_pool.h"
+#include "ss_thread.h"
+#include "ss_http.h"
+#include "ss_send.h"
 
 
+#define SS_MAX_LISTENERS 8
+
+// Socket handles given to the AS layer are the table index plus SOMAXCONN times the generation of the slot
+#define SS_HANDLE_GENERATIONS (0x7FFFFFFF / SOMAXCONN)
+
+/* listener_data - A bound, and possibly listening, server socket
+ */
+typedef struct {
+  int socket_fd;
+  unsigned short port;
+  struct sockaddr_in sockaddr;
+  bool is_listening;
+  bool is_http;
+} listener_data;
+
+struct reactor_data;
+
 /* socket_ctx - Every Context needs
  *
  */
-typedef struct {
+typedef struct context_data {
   // We need to hold onto the context to dispatch events from the background thread
   FREContext ctx;
   
-  // Server socket, port, and binding address
-  int server_socket_fd;
-  short server_port;
-  struct sockaddr_in server_sockaddr;
-  bool is_bound;
+  // Server sockets, the first one is the socket bind and listen work with, the rest are added with addListener
+  listener_data listeners[SS_MAX_LISTENERS];
+  
+  // Incoming connection rate limits, and a spare descriptor for shedding connections when we run out
+  ss_admission admission;
+  int reserve_fd;
+  
+  // ss_clock_ns() until which the listeners are left out of select, after running out of descriptors with no reserve
+  uint64_t accept_resume;
+  
+  // Set while accepts fail for lack of descriptors, so the AS layer hears about it once rather than per connection shed
+  bool descriptors_exhausted;
   
-  // Server thread management
-  volatile bool is_listening;
-  pthread_t server_thread;
+  // Memory held by the buffers of every socket this server owns
+  ss_budget budget;
   
-  // All sockets this server owns
+  // How the per priority send queues of our sockets share the link
+  ss_send_policy send_policy;
+  
+  // SO_BUSY_POLL microseconds for the sockets of this server, 0 to leave it off
+  int socket_busy_poll;
+  
+  // Responses the IO thread serves to HTTP listeners without waking the AS layer
+  ss_http_cache http_cache;
+  
+  // The reactor that services our sockets, and our link in its list of contexts
+  struct reactor_data* reactor;
+  struct context_data* next;
+  bool is_closing;
+  
+  // All sockets this server owns, the lock guards the table against the reactor releasing a socket in use.
+  // A slot's generation moves on every time it is freed, so events and calls about an earlier occupant never reach the next one.
   ss_socket* sockets[SOMAXCONN];
+  unsigned int generations[SOMAXCONN];
+  pthread_mutex_t sockets_lock;
+  
+  // Idle outbound connections kept for reuse
+  ss_pool pool;
 } context_data;
 
+/* reactor_data - The one IO thread shared by every context in the process
+ * The lock guards the context list and listener tables, and is held by the thread while it services sockets.
+ */
+typedef struct reactor_data {
+  pthread_mutex_t lock;
+  pthread_cond_t closed;
+  context_data* contexts;
+  
+  // Reactor thread management, the thread starts with the first listener or outbound connection
+  volatile bool is_running;
+  pthread_t thread;
+  int wake_fds[2];
+  
+  // Low latency mode, poll without blocking for spin_ns after every pass before select goes to sleep
+  uint64_t spin_ns;
+  
+  // What the reactor thread costs, totals updated after every select and the values at the last stats reset
+  uint64_t cpu_ns, polls, sleeps;
+  uint64_t base_cpu_ns, base_polls, base_sleeps, base_time;
+} reactor_data;
+
 context_data* context_data_alloc(void);
 void context_data_free(context_data* ctxdata);
+reactor_data* reactor_data_alloc(void);
+void reactor_data_free(reactor_data* reactor);
 void generate_error(FREObject* object);
-void* serverListeningThread(void *pArg);
+void* serverReactorThread(void *pArg);
 
 /* ServerSocketExtInitializer()
  * The extension initializer is called the first time the ActionScript side of the extension
@@ -107,5 +181,39 @@ FREObject ServerSocketSend(FREContext ctx, void* funcData, uint32_t argc, FREObj
 
 FREObject ServerSocketRecv(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
 
+FREObject ServerSocketStartCapture(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketStopCapture(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketStartTrace(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketStopTrace(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketTraceStats(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketAdmission(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketMemoryBudget(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketMemoryUsage(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketConnect(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketCloseSocket(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketConnectionPool(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketAddListener(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketRemoveListener(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketReactorStats(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketHttpRequest(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketHttpCache(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
+FREObject ServerSocketSendScheduling(FREContext ctx, void* funcData, uint32_t argc, FREObject argv[]);
+
 #endif
 
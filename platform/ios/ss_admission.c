@@ -0,0 +1,129 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "ss_socket.h"
+#include "ss_admission.h"
+
+/* ss_bucket_reset - Configure a bucket and fill it
+ */
+static void ss_bucket_reset(ss_token_bucket *bucket, double rate, double burst, uint64_t now)
+{
+  bucket->rate = rate;
+  bucket->burst = burst < 1 ? 1 : burst;
+  bucket->tokens = bucket->burst;
+  bucket->updated = now;
+}
+
+/* ss_bucket_refill - Add the tokens earned since the last refill
+ */
+static void ss_bucket_refill(ss_token_bucket *bucket, uint64_t now)
+{
+  if (bucket->rate <= 0) return;
+  
+  bucket->tokens = bucket->tokens + ((now - bucket->updated) / 1000000000.0) * bucket->rate;
+  if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+  bucket->updated = now;
+}
+
+/* ss_admission_lookup - Find the bucket for a source address, recycling an idle or the stalest slot if it is new
+ */
+static ss_token_bucket* ss_admission_lookup(ss_admission *admission, uint32_t address, uint64_t now)
+{
+  ss_admission_entry *entry = NULL, *victim = NULL;
+  uint32_t hash = address * 2654435761U;
+  int i = 0;
+  
+  for (i = 0; i < SS_ADMISSION_PROBE; ++i) {
+    entry = &admission->entries[(hash + i) & (SS_ADMISSION_TABLE_SIZE - 1)];
+    if (entry->address == address) return &entry->bucket;
+    
+    // Prefer an empty slot, otherwise the one that has gone the longest without a connection
+    if (entry->address == 0) { victim = entry; break; }
+    if (victim == NULL || entry->bucket.updated < victim->bucket.updated) victim = entry;
+  }
+  
+  victim->address = address;
+  ss_bucket_reset(&victim->bucket, admission->address_rate, admission->address_burst, now);
+  return &victim->bucket;
+}
+
+void ss_admission_init(ss_admission *admission)
+{
+  memset(admission, 0, sizeof(ss_admission));
+  pthread_mutex_init(&admission->lock, NULL);
+}
+
+void ss_admission_destroy(ss_admission *admission)
+{
+  pthread_mutex_destroy(&admission->lock);
+}
+
+/* ss_admission_configure - Set the admission limits, forgetting every address we have seen so far
+ * @param address_rate - Connections per second allowed from a single source address, 0 for no limit
+ * @param address_burst - Connections a single source address may open back to back
+ * @param global_rate - Connections per second allowed overall, 0 for no limit
+ * @param global_burst - Connections that may be opened back to back overall
+ */
+void ss_admission_configure(ss_admission *admission, double address_rate, double address_burst, double global_rate, double global_burst)
+{
+  pthread_mutex_lock(&admission->lock);
+  
+  uint64_t now = ss_clock_ns();
+  ss_bucket_reset(&admission->global, global_rate, global_burst, now);
+  admission->address_rate = address_rate;
+  admission->address_burst = address_burst;
+  memset(admission->entries, 0, sizeof(admission->entries));
+  
+  pthread_mutex_unlock(&admission->lock);
+}
+
+/* ss_admission_admit - Decide if a new connection may be accepted, taking a token from each bucket if so
+ * @param address - The IPv4 source address in network order
+ * @return - true if the connection should be accepted
+ */
+bool ss_admission_admit(ss_admission *admission, uint32_t address)
+{
+  bool admitted = true;
+  
+  // Nothing to enforce
+  if (admission->global.rate <= 0 && admission->address_rate <= 0) return true;
+  
+  pthread_mutex_lock(&admission->lock);
+  
+  uint64_t now = ss_clock_ns();
+  ss_token_bucket *global = admission->global.rate > 0 ? &admission->global : NULL;
+  ss_token_bucket *source = admission->address_rate > 0 ? ss_admission_lookup(admission, address, now) : NULL;
+  
+  // Only take tokens once we know both buckets can spare one
+  if (global != NULL) { ss_bucket_refill(global, now); if (global->tokens < 1) admitted = false; }
+  if (source != NULL) { ss_bucket_refill(source, now); if (source->tokens < 1) admitted = false; }
+  if (admitted) {
+    if (global != NULL) global->tokens = global->tokens - 1;
+    if (source != NULL) source->tokens = source->tokens - 1;
+  }
+  
+  pthread_mutex_unlock(&admission->lock);
+  
+  return admitted;
+}
@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_admission_h_
+#define ss_admission_h_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Source addresses tracked at once (power of two), and how far we probe for one before recycling a slot
+#define SS_ADMISSION_TABLE_SIZE 1024
+#define SS_ADMISSION_PROBE 8
+
+typedef struct {
+  double rate;        // Tokens added per second, 0 means the bucket never refuses
+  double burst;       // Most tokens the bucket can hold
+  double tokens;
+  uint64_t updated;   // ss_clock_ns() of the last refill
+} ss_token_bucket;
+
+typedef struct {
+  uint32_t address;   // IPv4 source address in network order, 0 for an empty slot
+  ss_token_bucket bucket;
+} ss_admission_entry;
+
+/* ss_admission - Token bucket admission control for incoming connections, per source address and overall
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  ss_token_bucket global;
+  double address_rate;
+  double address_burst;
+  ss_admission_entry entries[SS_ADMISSION_TABLE_SIZE];
+} ss_admission;
+
+void ss_admission_init(ss_admission *admission);
+void ss_admission_destroy(ss_admission *admission);
+void ss_admission_configure(ss_admission *admission, double address_rate, double address_burst, double global_rate, double global_burst);
+bool ss_admission_admit(ss_admission *admission, uint32_t address);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "ss_socket.h"
+#include "ss_capture.h"
+
+// The capture file is shared by every context, so is the lock that guards it
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static ss_capture_header* volatile capture = NULL;
+static size_t capture_length = 0;
+
+/* ss_capture_ring - The first byte of the record ring
+ */
+static unsigned char* ss_capture_ring(void)
+{
+  return (unsigned char *)capture + sizeof(ss_capture_header);
+}
+
+/* ss_capture_evict - Drop the oldest record in the ring to make room for a new one
+ */
+static void ss_capture_evict(void)
+{
+  ss_capture_record *record = (ss_capture_record *)&ss_capture_ring()[capture->tail];
+  uint64_t tail = capture->tail + SS_CAPTURE_ALIGN(sizeof(ss_capture_record) + record->size);
+  
+  // Wrap the tail if the next record would not fit, or if we hit the filler at the end of the ring
+  if (tail + sizeof(ss_capture_record) > capture->size) tail = 0;
+  else if (((ss_capture_record *)&ss_capture_ring()[tail])->type == SS_CAPTURE_PAD) tail = 0;
+  
+  capture->tail = tail;
+  capture->records--;
+  capture->dropped++;
+}
+
+/* ss_capture_append - Append a single record to the ring, evicting old records as needed
+ * Must be called with the capture lock held.
+ */
+static void ss_capture_append(ss_capture_type type, int connection, const unsigned char *data, unsigned int size)
+{
+  uint64_t head = capture->head;
+  uint64_t record_size = SS_CAPTURE_ALIGN(sizeof(ss_capture_record) + size);
+  ss_capture_record *record = NULL;
+  
+  // Wrap back to the start of the ring if the record will not fit before the end
+  if (head + record_size > capture->size) {
+    while (capture->records > 0 && capture->tail >= head) ss_capture_evict();
+    
+    // Leave a filler record behind so the reader knows to wrap
+    if (head + sizeof(ss_capture_record) <= capture->size) {
+      record = (ss_capture_record *)&ss_capture_ring()[head];
+      memset(record, 0, sizeof(ss_capture_record));
+    }
+    head = 0;
+  }
+  
+  // Evict any records we are about to overwrite
+  while (capture->records > 0 && capture->tail >= head && capture->tail < head + record_size) ss_capture_evict();
+  
+  // Write the record and its payload
+  record = (ss_capture_record *)&ss_capture_ring()[head];
+  record->timestamp = ss_clock_ns();
+  record->connection = (uint32_t)connection;
+  record->type = (uint16_t)type;
+  record->size = (uint16_t)size;
+  if (size > 0) memcpy(&ss_capture_ring()[head + sizeof(ss_capture_record)], data, size);
+  
+  // Publish the record only after its contents are in place
+  __sync_synchronize();
+  if (capture->records == 0) capture->tail = head;
+  capture->head = head + record_size;
+  capture->records++;
+}
+
+/* ss_capture_open - Start capturing socket activity into an mmap'd ring file
+ * @param path - The file to capture into, it will be truncated
+ * @param size - The size of the record ring in bytes
+ * @return - true if the capture was started
+ */
+bool ss_capture_open(const char *path, unsigned int size)
+{
+  // The ring must be able to hold at least one full record
+  size = SS_CAPTURE_ALIGN(size);
+  if (size < SS_CAPTURE_ALIGN(sizeof(ss_capture_record) + SS_CAPTURE_MAX_PAYLOAD)) {
+    size = SS_CAPTURE_ALIGN(sizeof(ss_capture_record) + SS_CAPTURE_MAX_PAYLOAD);
+  }
+  
+  ss_capture_close();
+  
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  
+  // Size the file and map it into memory, the mapping outlives the descriptor
+  size_t length = sizeof(ss_capture_header) + size;
+  if (ftruncate(fd, (off_t)length) < 0) { close(fd); return false; }
+  void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  
+  // Initialize the header
+  ss_capture_header *header = (ss_capture_header *)map;
+  memset(header, 0, sizeof(ss_capture_header));
+  memcpy(header->magic, SS_CAPTURE_MAGIC, sizeof(header->magic));
+  header->size = size;
+  
+  pthread_mutex_lock(&capture_lock);
+  capture_length = length;
+  capture = header;
+  pthread_mutex_unlock(&capture_lock);
+  
+  return true;
+}
+
+/* ss_capture_close - Stop capturing, flush the ring file to disk and unmap it
+ */
+void ss_capture_close(void)
+{
+  pthread_mutex_lock(&capture_lock);
+  if (capture != NULL) {
+    msync((void *)capture, capture_length, MS_SYNC);
+    munmap((void *)capture, capture_length);
+    capture = NULL;
+    capture_length = 0;
+  }
+  pthread_mutex_unlock(&capture_lock);
+}
+
+/* ss_capture_write - Record a socket event if a capture is running
+ * @param type - The type of event
+ * @param connection - The socket descriptor the event happened on
+ * @param data - The payload for send and receive events, otherwise NULL
+ * @param size - The size of the payload
+ */
+void ss_capture_write(ss_capture_type type, int connection, const unsigned char *data, unsigned int size)
+{
+  // Cheap check so the reactor pays nothing when no capture is running
+  if (capture == NULL) return;
+  
+  pthread_mutex_lock(&capture_lock);
+  if (capture != NULL) {
+    // Split large payloads across several records
+    do {
+      unsigned int chunk = size > SS_CAPTURE_MAX_PAYLOAD ? SS_CAPTURE_MAX_PAYLOAD : size;
+      ss_capture_append(type, connection, data, chunk);
+      data = data + chunk;
+      size = size - chunk;
+    } while (size > 0);
+  }
+  pthread_mutex_unlock(&capture_lock);
+}
@@ -0,0 +1,72 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_capture_h_
+#define ss_capture_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SS_CAPTURE_MAGIC "SSCAP001"
+#define SS_CAPTURE_DEFAULT_SIZE (8 * 1024 * 1024)
+#define SS_CAPTURE_MAX_PAYLOAD 0xFFFF
+
+/* Records are padded so every record header in the ring stays 8 byte aligned */
+#define SS_CAPTURE_ALIGN(size) (((size) + 7) & ~7)
+
+typedef enum {
+  SS_CAPTURE_PAD = 0,     // Filler at the end of the ring, the reader wraps to offset 0
+  SS_CAPTURE_ACCEPT = 1,  // A connection was accepted
+  SS_CAPTURE_CLOSE = 2,   // A connection was closed
+  SS_CAPTURE_RECV = 3,    // Bytes received from the peer, payload follows the record
+  SS_CAPTURE_SEND = 4     // Bytes sent to the peer, payload follows the record
+} ss_capture_type;
+
+/* ss_capture_header - Sits at the start of the capture file, the record ring follows it
+ * Offsets are relative to the first byte after the header.
+ */
+typedef struct {
+  char magic[8];
+  uint64_t size;      // Size of the record ring
+  uint64_t head;      // Offset the next record will be written at
+  uint64_t tail;      // Offset of the oldest record in the ring
+  uint64_t records;   // Number of records between tail and head
+  uint64_t dropped;   // Number of records overwritten because the ring wrapped
+} ss_capture_header;
+
+/* ss_capture_record - One captured event, followed by size bytes of payload
+ */
+typedef struct {
+  uint64_t timestamp; // ss_clock_ns() at the time of the event
+  uint32_t connection;
+  uint16_t type;
+  uint16_t size;
+} ss_capture_record;
+
+bool ss_capture_open(const char *path, unsigned int size);
+void ss_capture_close(void);
+
+void ss_capture_write(ss_capture_type type, int connection, const unsigned char *data, unsigned int size);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ss_http.h"
+#include "ss_send.h"
+
+/* ss_http_lower - ASCII lower case, header names and tokens are case insensitive
+ */
+static unsigned char ss_http_lower(unsigned char c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* ss_http_find - Find a run of bytes in data[from, to)
+ * @return - The offset of the match, or -1 if there is none
+ */
+static int64_t ss_http_find(const unsigned char *data, uint32_t from, uint32_t to, const char *text, uint32_t text_length)
+{
+  uint32_t i;
+  for (i = from; i + text_length <= to; ++i) {
+    if (data[i] == (unsigned char)text[0] && memcmp(&data[i], text, text_length) == 0) return i;
+  }
+  return -1;
+}
+
+/* ss_http_span_contains - Case insensitive search for a token in a span, used for Connection and Transfer-Encoding
+ */
+static bool ss_http_span_contains(const unsigned char *data, ss_http_span span, const char *text)
+{
+  uint32_t i, j, text_length = (uint32_t)strlen(text);
+  for (i = 0; i + text_length <= span.length; ++i) {
+    for (j = 0; j < text_length && ss_http_lower(data[span.offset + i + j]) == (unsigned char)text[j]; ++j);
+    if (j == text_length) return true;
+  }
+  return false;
+}
+
+/* ss_http_span_equals - Case insensitive comparison of a span with a string
+ * @param data - The start of the request
+ * @param span - The span to compare
+ * @param text - Lower case text to compare against
+ */
+bool ss_http_span_equals(const unsigned char *data, ss_http_span span, const char *text)
+{
+  uint32_t i;
+  if (strlen(text) != span.length) return false;
+  for (i = 0; i < span.length; ++i) {
+    if (ss_http_lower(data[span.offset + i]) != (unsigned char)text[i]) return false;
+  }
+  return true;
+}
+
+/* ss_http_parse_head - Split the request line and headers into spans, and pick up how the body is framed
+ * @param head_end - Offset of the blank line that ends the headers
+ * @return - false if the request is malformed
+ */
+static bool ss_http_parse_head(ss_http_request *request, const unsigned char *data, uint32_t head_end)
+{
+  int64_t line_end = ss_http_find(data, 0, head_end + 2, "\r\n", 2);
+  int64_t space = 0;
+  uint32_t position = 0;
+  
+  // Request line, METHOD SP target SP HTTP/1.x
+  space = ss_http_find(data, 0, (uint32_t)line_end, " ", 1);
+  if (space <= 0) return false;
+  request->method.offset = 0;
+  request->method.length = (uint32_t)space;
+  
+  position = (uint32_t)space + 1;
+  space = ss_http_find(data, position, (uint32_t)line_end, " ", 1);
+  if (space <= position) return false;
+  request->path.offset = position;
+  request->path.length = (uint32_t)space - position;
+  
+  position = (uint32_t)space + 1;
+  request->version.offset = position;
+  request->version.length = (uint32_t)line_end - position;
+  if (request->version.length != 8 || memcmp(&data[position], "HTTP/1.", 7) != 0) return false;
+  
+  // HTTP/1.1 connections stay open unless asked not to, HTTP/1.0 connections only if asked to
+  request->keep_alive = data[position + 7] != '0';
+  
+  // Headers, one per line up to the blank line
+  for (position = (uint32_t)line_end + 2; position < head_end + 2; position = (uint32_t)line_end + 2) {
+    line_end = ss_http_find(data, position, head_end + 2, "\r\n", 2);
+    
+    // Folded header lines are obsolete, and a name without a colon is not a header
+    int64_t colon = ss_http_find(data, position, (uint32_t)line_end, ":", 1);
+    if (colon <= position || data[position] == ' ' || data[position] == '\t') return false;
+    if (request->header_count == SS_HTTP_MAX_HEADERS) return false;
+    
+    ss_http_span name = { position, (uint32_t)colon - position };
+    ss_http_span value = { (uint32_t)colon + 1, (uint32_t)(line_end - colon - 1) };
+    while (value.length > 0 && (data[value.offset] == ' ' || data[value.offset] == '\t')) { value.offset++; value.length--; }
+    while (value.length > 0 && (data[value.offset + value.length - 1] == ' ' || data[value.offset + value.length - 1] == '\t')) value.length--;
+    request->header_names[request->header_count] = name;
+    request->header_values[request->header_count] = value;
+    request->header_count++;
+    
+    // Pick up the headers that frame the body and decide the fate of the connection
+    if (ss_http_span_equals(data, name, "content-length")) {
+      uint32_t i;
+      uint64_t length = 0;
+      if (value.length == 0) return false;
+      for (i = 0; i < value.length; ++i) {
+        if (data[value.offset + i] < '0' || data[value.offset + i] > '9') return false;
+        length = length * 10 + (data[value.offset + i] - '0');
+        if (length > 0x7FFFFFFF) return false;
+      }
+      request->remaining = length;
+    }
+    else if (ss_http_span_equals(data, name, "transfer-encoding")) {
+      request->chunked = ss_http_span_contains(data, value, "chunked");
+    }
+    else if (ss_http_span_equals(data, name, "connection")) {
+      if (ss_http_span_contains(data, value, "close")) request->keep_alive = false;
+      else if (ss_http_span_contains(data, value, "keep-alive")) request->keep_alive = true;
+    }
+  }
+  
+  // A chunked body ignores any Content-Length
+  if (request->chunked) request->remaining = 0;
+  
+  return true;
+}
+
+/* ss_http_reset - Get ready to parse the next request on the connection
+ */
+void ss_http_reset(ss_http_request *request)
+{
+  memset(request, 0, sizeof(ss_http_request));
+  request->started = ss_clock_ns();
+}
+
+/* ss_http_parse - Parse as much of the request at the start of data as has arrived
+ * Call again with the same request and data, grown by whatever arrived since, until the request is complete.
+ * Nothing is copied out of data, chunked bodies are moved together in place.
+ * @param request - The parser state, reset before the first call for each request
+ * @param data - The start of the request in the read buffer
+ * @param size - The bytes of data available
+ * @return - SS_HTTP_COMPLETE once request->length bytes hold the whole request, SS_HTTP_INVALID if it is malformed,
+ *           SS_HTTP_TOO_LARGE if its body would go over SS_HTTP_MAX_BODY
+ */
+ss_http_result ss_http_parse(ss_http_request *request, unsigned char *data, uint32_t size)
+{
+  int64_t found = 0;
+  
+  for (;;) {
+    switch (request->state) {
+      case SS_HTTP_STATE_HEAD:
+        // Wait for the blank line, starting from where the last search left off
+        found = ss_http_find(data, request->scanned > 3 ? request->scanned - 3 : 0, size, "\r\n\r\n", 4);
+        if (found < 0) {
+          request->scanned = size;
+          return size > SS_HTTP_MAX_HEAD ? SS_HTTP_INVALID : SS_HTTP_INCOMPLETE;
+        }
+        if (found + 4 > SS_HTTP_MAX_HEAD || ss_http_parse_head(request, data, (uint32_t)found) == false) return SS_HTTP_INVALID;
+        if (request->remaining > SS_HTTP_MAX_BODY) return SS_HTTP_TOO_LARGE;
+        
+        request->scanned = request->body.offset = (uint32_t)found + 4;
+        request->body.length = 0;
+        request->state = request->chunked ? SS_HTTP_STATE_CHUNK_SIZE : request->remaining > 0 ? SS_HTTP_STATE_BODY : SS_HTTP_STATE_DONE;
+        break;
+        
+      case SS_HTTP_STATE_BODY:
+        if (size - request->body.offset < request->remaining) return SS_HTTP_INCOMPLETE;
+        request->body.length = (uint32_t)request->remaining;
+        request->scanned = request->body.offset + request->body.length;
+        request->remaining = 0;
+        request->state = SS_HTTP_STATE_DONE;
+        break;
+        
+      case SS_HTTP_STATE_CHUNK_SIZE:
+        found = ss_http_find(data, request->scanned, size, "\r\n", 2);
+        if (found < 0) return size - request->scanned > SS_HTTP_MAX_LINE ? SS_HTTP_INVALID : SS_HTTP_INCOMPLETE;
+        
+        // Hex size, optionally followed by chunk extensions we ignore
+        {
+          uint32_t i = request->scanned, digits = 0;
+          uint64_t chunk = 0;
+          for (; i < found; ++i, ++digits) {
+            unsigned char c = ss_http_lower(data[i]);
+            if (c >= '0' && c <= '9') chunk = chunk * 16 + (c - '0');
+            else if (c >= 'a' && c <= 'f') chunk = chunk * 16 + (c - 'a' + 10);
+            else break;
+            if (chunk > 0x7FFFFFFF) return SS_HTTP_INVALID;
+          }
+          if (digits == 0) return SS_HTTP_INVALID;
+          if (request->body.length + chunk > SS_HTTP_MAX_BODY) return SS_HTTP_TOO_LARGE;
+          request->remaining = chunk;
+        }
+        
+        request->scanned = (uint32_t)found + 2;
+        request->state = request->remaining > 0 ? SS_HTTP_STATE_CHUNK_DATA : SS_HTTP_STATE_TRAILER;
+        break;
+        
+      case SS_HTTP_STATE_CHUNK_DATA:
+        // Wait for the whole chunk and its line ending, then move it up against the body so far
+        if (size - request->scanned < request->remaining + 2) return SS_HTTP_INCOMPLETE;
+        if (data[request->scanned + request->remaining] != '\r' || data[request->scanned + request->remaining + 1] != '\n') return SS_HTTP_INVALID;
+        
+        memmove(&data[request->body.offset + request->body.length], &data[request->scanned], (size_t)request->remaining);
+        request->body.length += (uint32_t)request->remaining;
+        request->scanned += (uint32_t)request->remaining + 2;
+        request->remaining = 0;
+        request->state = SS_HTTP_STATE_CHUNK_SIZE;
+        break;
+        
+      case SS_HTTP_STATE_TRAILER:
+        // Skip trailer headers up to the blank line
+        found = ss_http_find(data, request->scanned, size, "\r\n", 2);
+        if (found < 0) return size - request->scanned > SS_HTTP_MAX_LINE ? SS_HTTP_INVALID : SS_HTTP_INCOMPLETE;
+        if (found == request->scanned) request->state = SS_HTTP_STATE_DONE;
+        request->scanned = (uint32_t)found + 2;
+        break;
+        
+      case SS_HTTP_STATE_DONE:
+        request->length = request->scanned;
+        return SS_HTTP_COMPLETE;
+    }
+  }
+}
+
+/* ss_http_hash - FNV-1a hash of a path
+ */
+static uint32_t ss_http_hash(const unsigned char *path, uint32_t length)
+{
+  uint32_t hash = 2166136261u, i;
+  for (i = 0; i < length; ++i) {
+    hash = (hash ^ path[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* ss_http_cache_find - Find the entry for a path, call with the cache lock held
+ * @return - The index of the entry, or -1 if the path is not cached
+ */
+static int ss_http_cache_find(ss_http_cache *cache, const unsigned char *path, uint32_t length, uint32_t hash)
+{
+  int i;
+  for (i = 0; i < cache->count; ++i) {
+    ss_http_cache_entry *entry = &cache->entries[i];
+    if (entry->hash == hash && strlen(entry->path) == length && memcmp(entry->path, path, length) == 0) return i;
+  }
+  return -1;
+}
+
+void ss_http_cache_init(ss_http_cache *cache)
+{
+  memset(cache, 0, sizeof(ss_http_cache));
+  pthread_mutex_init(&cache->lock, NULL);
+}
+
+void ss_http_cache_destroy(ss_http_cache *cache)
+{
+  int i;
+  for (i = 0; i < cache->count; ++i) {
+    free(cache->entries[i].path);
+    free(cache->entries[i].response);
+  }
+  cache->count = 0;
+  pthread_mutex_destroy(&cache->lock);
+}
+
+/* ss_http_cache_put - Cache a complete, pre-serialized response for GET requests of a path
+ * @param path - The request target to match exactly, query string included
+ * @param response - The status line, headers and body, or NULL to remove the path from the cache
+ * @param length - The size of the response
+ * @return - false if the cache is full
+ */
+bool ss_http_cache_put(ss_http_cache *cache, const char *path, const unsigned char *response, uint32_t length)
+{
+  uint32_t path_length = (uint32_t)strlen(path);
+  uint32_t hash = ss_http_hash((const unsigned char *)path, path_length);
+  bool stored = true;
+  
+  // Copy the response before taking the lock so the IO thread does not wait on us
+  unsigned char *copy = NULL;
+  if (response != NULL && length > 0) {
+    copy = malloc(length);
+    if (copy == NULL) return false;
+    memcpy(copy, response, length);
+  }
+  
+  pthread_mutex_lock(&cache->lock);
+  int index = ss_http_cache_find(cache, (const unsigned char *)path, path_length, hash);
+  if (index >= 0) {
+    // Replace or remove the existing response
+    free(cache->entries[index].response);
+    if (copy != NULL) {
+      cache->entries[index].response = copy;
+      cache->entries[index].length = length;
+    }
+    else {
+      free(cache->entries[index].path);
+      cache->entries[index] = cache->entries[--cache->count];
+    }
+  }
+  else if (copy != NULL && cache->count < SS_HTTP_CACHE_SIZE) {
+    ss_http_cache_entry *entry = &cache->entries[cache->count++];
+    entry->hash = hash;
+    entry->path = strdup(path);
+    entry->response = copy;
+    entry->length = length;
+  }
+  else if (copy != NULL) {
+    free(copy);
+    stored = false;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  
+  return stored;
+}
+
+/* ss_http_cache_serve - Queue the cached response for a path as a normal priority message
+ * @param budget - The memory budget the send queue counts against
+ * @return - SS_HTTP_CACHE_SERVED if the response was written, SS_HTTP_CACHE_OVER_BUDGET if the path is cached but the
+ *           budget can not cover queueing the response, otherwise SS_HTTP_CACHE_MISS
+ */
+ss_http_cache_result ss_http_cache_serve(ss_http_cache *cache, const unsigned char *path, uint32_t path_length, ss_send_queue *out, ss_budget *budget)
+{
+  ss_http_cache_result result = SS_HTTP_CACHE_MISS;
+  
+  // Skip the lock entirely while nothing is cached
+  if (cache->count == 0) return result;
+  
+  uint32_t hash = ss_http_hash(path, path_length);
+  pthread_mutex_lock(&cache->lock);
+  int index = ss_http_cache_find(cache, path, path_length, hash);
+  if (index >= 0) {
+    int growth = ss_send_queue_growth(out, SS_PRIORITY_NORMAL, cache->entries[index].length);
+    result = growth > 0 && ss_budget_exhausted(budget, growth) ? SS_HTTP_CACHE_OVER_BUDGET : SS_HTTP_CACHE_SERVED;
+  }
+  if (result == SS_HTTP_CACHE_SERVED) ss_send_queue_write(out, SS_PRIORITY_NORMAL, cache->entries[index].response, cache->entries[index].length, true);
+  pthread_mutex_unlock(&cache->lock);
+  
+  return result;
+}
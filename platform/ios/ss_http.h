@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_http_h_
+#define ss_http_h_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ss_socket.h"
+
+#define SS_HTTP_MAX_HEADERS 32
+#define SS_HTTP_MAX_HEAD 8192     // Request line and headers together
+#define SS_HTTP_MAX_LINE 1024     // Chunk size and trailer lines
+#define SS_HTTP_MAX_BODY 1048576  // Decoded body, larger requests are answered with 413
+#define SS_HTTP_MAX_REQUEST (SS_HTTP_MAX_HEAD + SS_HTTP_MAX_BODY + 2 * SS_HTTP_MAX_LINE)
+#define SS_HTTP_CACHE_SIZE 64
+
+typedef enum {
+  SS_HTTP_INCOMPLETE = 0,
+  SS_HTTP_COMPLETE,
+  SS_HTTP_INVALID,
+  SS_HTTP_TOO_LARGE
+} ss_http_result;
+
+typedef enum {
+  SS_HTTP_CACHE_MISS = 0,
+  SS_HTTP_CACHE_SERVED,
+  SS_HTTP_CACHE_OVER_BUDGET
+} ss_http_cache_result;
+
+typedef enum {
+  SS_HTTP_STATE_HEAD = 0,
+  SS_HTTP_STATE_BODY,
+  SS_HTTP_STATE_CHUNK_SIZE,
+  SS_HTTP_STATE_CHUNK_DATA,
+  SS_HTTP_STATE_TRAILER,
+  SS_HTTP_STATE_DONE
+} ss_http_state;
+
+/* ss_http_span - A run of bytes in the read buffer, relative to the start of the request
+ */
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+} ss_http_span;
+
+/* ss_http_request - Incremental parser state and the parsed request, the request itself stays in the read buffer
+ */
+typedef struct ss_http_request {
+  ss_http_state state;
+  uint32_t scanned;         // Bytes already looked at, so every parse picks up where the last one stopped
+  uint64_t remaining;       // Body or chunk bytes still to come
+  
+  ss_http_span method;
+  ss_http_span path;
+  ss_http_span version;
+  ss_http_span header_names[SS_HTTP_MAX_HEADERS];
+  ss_http_span header_values[SS_HTTP_MAX_HEADERS];
+  int header_count;
+  
+  // Chunked bodies are moved together in place as their chunks arrive, so the body is always one span
+  ss_http_span body;
+  bool chunked;
+  bool keep_alive;
+  
+  // Bytes the whole request takes up in the buffer once it is complete
+  uint32_t length;
+  
+  // Set while the AS layer holds the request, later requests on the connection wait until it responds
+  bool awaiting_response;
+  bool respond_keep_alive;
+  
+  // ss_clock_ns() of when the connection started waiting for this request
+  uint64_t started;
+} ss_http_request;
+
+typedef struct {
+  uint32_t hash;
+  char *path;
+  unsigned char *response;
+  uint32_t length;
+} ss_http_cache_entry;
+
+/* ss_http_cache - Pre-serialized responses served straight from the IO thread, keyed by request path
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  int count;
+  ss_http_cache_entry entries[SS_HTTP_CACHE_SIZE];
+} ss_http_cache;
+
+void ss_http_reset(ss_http_request *request);
+ss_http_result ss_http_parse(ss_http_request *request, unsigned char *data, uint32_t size);
+bool ss_http_span_equals(const unsigned char *data, ss_http_span span, const char *text);
+
+void ss_http_cache_init(ss_http_cache *cache);
+void ss_http_cache_destroy(ss_http_cache *cache);
+bool ss_http_cache_put(ss_http_cache *cache, const char *path, const unsigned char *response, uint32_t length);
+ss_http_cache_result ss_http_cache_serve(ss_http_cache *cache, const unsigned char *path, uint32_t path_length, ss_send_queue *out, ss_budget *budget);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "ss_socket.h"
+#include "ss_pool.h"
+
+/* ss_pool_same_destination - Compare the address and port of two destinations
+ */
+static bool ss_pool_same_destination(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+  return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* ss_pool_remove - Remove an entry, closing its connection if asked to
+ * Must be called with the pool lock held.
+ */
+static void ss_pool_remove(ss_pool *pool, int index, bool close_socket)
+{
+  if (close_socket) close(pool->entries[index].socket_fd);
+  pool->entries[index] = pool->entries[--pool->count];
+}
+
+/* ss_pool_alive - Check that a parked connection has not been closed or written to by the peer
+ */
+static bool ss_pool_alive(int socket_fd)
+{
+  unsigned char peek;
+  ssize_t len = recv(socket_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+  return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void ss_pool_init(ss_pool *pool)
+{
+  memset(pool, 0, sizeof(ss_pool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->idle_ns = SS_POOL_IDLE_MS * 1000000ULL;
+}
+
+/* ss_pool_destroy - Close every parked connection
+ */
+void ss_pool_destroy(ss_pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->count > 0) ss_pool_remove(pool, 0, true);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/* ss_pool_configure - Set how many idle connections to keep per destination, and for how long
+ * @param max_per_destination - Idle connections kept per destination, 0 disables pooling
+ * @param idle_ms - Milliseconds a connection may sit idle before it is closed
+ */
+void ss_pool_configure(ss_pool *pool, int max_per_destination, int idle_ms)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->max_per_destination = max_per_destination < 0 ? 0 : max_per_destination;
+  pool->idle_ns = (uint64_t)(idle_ms < 0 ? 0 : idle_ms) * 1000000ULL;
+  
+  // Close anything we are no longer allowed to keep
+  if (pool->max_per_destination == 0) {
+    while (pool->count > 0) ss_pool_remove(pool, 0, true);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* ss_pool_put - Park an idle connection for reuse
+ * @param address - The destination the connection is to
+ * @param socket_fd - The connected socket
+ * @return - true if the pool took the connection, otherwise the caller still owns it
+ */
+bool ss_pool_put(ss_pool *pool, const struct sockaddr_in *address, int socket_fd)
+{
+  bool pooled = false;
+  int i = 0, same_destination = 0;
+  
+  pthread_mutex_lock(&pool->lock);
+  for (i = 0; i < pool->count; ++i) {
+    if (ss_pool_same_destination(&pool->entries[i].address, address)) same_destination++;
+  }
+  
+  if (pool->count < SS_POOL_SIZE && same_destination < pool->max_per_destination) {
+    pool->entries[pool->count].address = *address;
+    pool->entries[pool->count].socket_fd = socket_fd;
+    pool->entries[pool->count].idle_since = ss_clock_ns();
+    pool->count++;
+    pooled = true;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  
+  return pooled;
+}
+
+/* ss_pool_take - Take a live idle connection to a destination out of the pool
+ * Connections the peer has closed in the meantime are thrown away.
+ * @param address - The destination we want a connection to
+ * @return - The connected socket, or -1 if there is none
+ */
+int ss_pool_take(ss_pool *pool, const struct sockaddr_in *address)
+{
+  int i = 0, socket_fd = -1;
+  
+  pthread_mutex_lock(&pool->lock);
+  
+  // Walk backwards so we reuse the most recently parked connection first
+  for (i = pool->count - 1; i >= 0 && socket_fd < 0; --i) {
+    if (ss_pool_same_destination(&pool->entries[i].address, address) == false) continue;
+    
+    if (ss_pool_alive(pool->entries[i].socket_fd)) socket_fd = pool->entries[i].socket_fd;
+    ss_pool_remove(pool, i, socket_fd < 0);
+  }
+  
+  pthread_mutex_unlock(&pool->lock);
+  
+  return socket_fd;
+}
+
+/* ss_pool_expire - Close connections that have been idle for too long
+ */
+void ss_pool_expire(ss_pool *pool, uint64_t now)
+{
+  int i = 0;
+  
+  // Cheap check so an empty pool costs nothing
+  if (pool->count == 0) return;
+  
+  pthread_mutex_lock(&pool->lock);
+  for (i = pool->count - 1; i >= 0; --i) {
+    if (now - pool->entries[i].idle_since >= pool->idle_ns) ss_pool_remove(pool, i, true);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* ss_pool_watch - Add every parked connection to a select read set, an idle connection only turns readable when the peer
+ * closes it or sends something we would never read
+ */
+void ss_pool_watch(ss_pool *pool, fd_set *read_set, int *high_socket)
+{
+  int i = 0;
+  
+  if (pool->count == 0) return;
+  
+  pthread_mutex_lock(&pool->lock);
+  for (i = 0; i < pool->count; ++i) {
+    FD_SET(pool->entries[i].socket_fd, read_set);
+    if (pool->entries[i].socket_fd > *high_socket) *high_socket = pool->entries[i].socket_fd;
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* ss_pool_reap - Close parked connections select found readable
+ * A connection may have been taken, and its descriptor reused, since the set was built, so each one is checked again.
+ */
+void ss_pool_reap(ss_pool *pool, fd_set *read_set)
+{
+  int i = 0;
+  
+  if (pool->count == 0) return;
+  
+  pthread_mutex_lock(&pool->lock);
+  for (i = pool->count - 1; i >= 0; --i) {
+    if (FD_ISSET(pool->entries[i].socket_fd, read_set) == false) continue;
+    FD_CLR(pool->entries[i].socket_fd, read_set);
+    if (ss_pool_alive(pool->entries[i].socket_fd) == false) ss_pool_remove(pool, i, true);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
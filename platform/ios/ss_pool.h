@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_pool_h_
+#define ss_pool_h_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+#define SS_POOL_SIZE 64
+#define SS_POOL_IDLE_MS 30000
+
+typedef struct {
+  struct sockaddr_in address;
+  int socket_fd;
+  uint64_t idle_since;  // ss_clock_ns() of when the connection was parked
+} ss_pool_entry;
+
+/* ss_pool - Idle outbound connections kept alive for reuse, keyed by destination
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  int max_per_destination;  // 0 disables pooling
+  uint64_t idle_ns;         // How long a connection may sit idle before it is closed
+  int count;
+  ss_pool_entry entries[SS_POOL_SIZE];
+} ss_pool;
+
+void ss_pool_init(ss_pool *pool);
+void ss_pool_destroy(ss_pool *pool);
+void ss_pool_configure(ss_pool *pool, int max_per_destination, int idle_ms);
+
+bool ss_pool_put(ss_pool *pool, const struct sockaddr_in *address, int socket_fd);
+int ss_pool_take(ss_pool *pool, const struct sockaddr_in *address);
+void ss_pool_expire(ss_pool *pool, uint64_t now);
+void ss_pool_watch(ss_pool *pool, fd_set *read_set, int *high_socket);
+void ss_pool_reap(ss_pool *pool, fd_set *read_set);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include "ss_send.h"
+
+/* ss_send_policy_init - Weighted scheduling favouring control messages, with bulk data limited in flight
+ */
+void ss_send_policy_init(ss_send_policy *policy)
+{
+  ss_send_policy_configure(policy, false, 8, 4, 1, SS_SEND_BULK_IN_FLIGHT);
+}
+
+/* ss_send_policy_configure - Change how send queues are flushed
+ * @param strict - true to always send the most urgent class first, false to share the link by weight
+ * @param control_weight, normal_weight, bulk_weight - Relative shares of the classes, raised to at least 1 so no class starves,
+ *                                                    and held to SS_SEND_MAX_WEIGHT so a round's share fits the deficit
+ * @param bulk_in_flight - Bulk bytes allowed in the kernel send queue at once, 0 for no limit
+ */
+void ss_send_policy_configure(ss_send_policy *policy, bool strict, int control_weight, int normal_weight, int bulk_weight, int bulk_in_flight)
+{
+  policy->strict = strict;
+  policy->weights[SS_PRIORITY_CONTROL] = control_weight > 0 ? (control_weight < SS_SEND_MAX_WEIGHT ? control_weight : SS_SEND_MAX_WEIGHT) : 1;
+  policy->weights[SS_PRIORITY_NORMAL] = normal_weight > 0 ? (normal_weight < SS_SEND_MAX_WEIGHT ? normal_weight : SS_SEND_MAX_WEIGHT) : 1;
+  policy->weights[SS_PRIORITY_BULK] = bulk_weight > 0 ? (bulk_weight < SS_SEND_MAX_WEIGHT ? bulk_weight : SS_SEND_MAX_WEIGHT) : 1;
+  policy->bulk_in_flight = bulk_in_flight > 0 ? bulk_in_flight : 0;
+}
+
+/* ss_send_queue_init - Set up empty queues, only the normal class allocates its buffer up front
+ */
+void ss_send_queue_init(ss_send_queue *queue, ss_budget *budget)
+{
+  int i = 0;
+  pthread_mutex_init(&queue->lock, NULL);
+  for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+    ss_send_class *send_class = &queue->classes[i];
+    ss_buffer_init(&send_class->buffer, budget, i == SS_PRIORITY_NORMAL ? SS_BUFFER_SIZE : 0);
+    send_class->lengths = NULL;
+    send_class->head = send_class->count = send_class->capacity = 0;
+    send_class->open_length = 0;
+    send_class->deficit = 0;
+  }
+  queue->current = -1;
+  queue->current_remaining = 0;
+  queue->current_open = false;
+  queue->next = 0;
+}
+
+void ss_send_queue_destroy(ss_send_queue *queue)
+{
+  int i = 0;
+  for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+    ss_buffer_destroy(&queue->classes[i].buffer);
+    free(queue->classes[i].lengths);
+    queue->classes[i].lengths = NULL;
+  }
+  pthread_mutex_destroy(&queue->lock);
+}
+
+/* ss_send_class_push - Append the length of a complete message to the ring of a class, growing it as needed
+ */
+static void ss_send_class_push(ss_send_class *send_class, unsigned int length)
+{
+  if (send_class->count == send_class->capacity) {
+    int i = 0, capacity = send_class->capacity > 0 ? send_class->capacity * 2 : 8;
+    unsigned int *lengths = malloc(sizeof(unsigned int) * capacity);
+    assert(lengths != NULL);
+    
+    // Unroll the ring into the new array
+    for (i = 0; i < send_class->count; ++i) lengths[i] = send_class->lengths[(send_class->head + i) % send_class->capacity];
+    free(send_class->lengths);
+    send_class->lengths = lengths;
+    send_class->capacity = capacity;
+    send_class->head = 0;
+  }
+  send_class->lengths[(send_class->head + send_class->count) % send_class->capacity] = length;
+  send_class->count++;
+}
+
+static unsigned int ss_send_class_pop(ss_send_class *send_class)
+{
+  unsigned int length = send_class->lengths[send_class->head];
+  send_class->head = (send_class->head + 1) % send_class->capacity;
+  send_class->count--;
+  return length;
+}
+
+/* ss_send_queue_growth - Work out how much memory queueing data in a class would take on
+ * @return - The number of bytes the class buffer would grow by
+ */
+int ss_send_queue_growth(ss_send_queue *queue, ss_priority priority, unsigned int size)
+{
+  if (priority < SS_PRIORITY_CONTROL || priority >= SS_PRIORITY_COUNT) priority = SS_PRIORITY_NORMAL;
+  return ss_buffer_growth(&queue->classes[priority].buffer, size);
+}
+
+/* ss_send_queue_write - Queue data in a class, ending the message if this is its last piece
+ * @param queue - The send queue of the socket
+ * @param priority - The class to queue the data in
+ * @param data - The data to queue
+ * @param size - The size of the data
+ * @param end - true if the data completes a message, messages are the points where the scheduler may switch classes
+ * @return - The size of the data queued
+ */
+int ss_send_queue_write(ss_send_queue *queue, ss_priority priority, const unsigned char *data, unsigned int size, bool end)
+{
+  if (priority < SS_PRIORITY_CONTROL || priority >= SS_PRIORITY_COUNT) priority = SS_PRIORITY_NORMAL;
+  ss_send_class *send_class = &queue->classes[priority];
+  
+  pthread_mutex_lock(&queue->lock);
+  if (size > 0) ss_write(&send_class->buffer, data, size);
+  
+  if (queue->current == (int)priority && queue->current_open) {
+    // The rest of the message that is already on the wire
+    queue->current_remaining = queue->current_remaining + size;
+    if (end) queue->current_open = false;
+    
+    // The message may already be fully sent, in which case the scheduler is free to pick again
+    if (queue->current_open == false && queue->current_remaining == 0) queue->current = -1;
+  }
+  else {
+    // Messages only become complete once the AS layer says so
+    send_class->open_length = send_class->open_length + size;
+    if (end && send_class->open_length > 0) {
+      ss_send_class_push(send_class, send_class->open_length);
+      send_class->open_length = 0;
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  
+  return size;
+}
+
+/* ss_send_queue_end - End every message that is still being written, so a closing socket can flush everything
+ */
+void ss_send_queue_end(ss_send_queue *queue)
+{
+  int i = 0;
+  pthread_mutex_lock(&queue->lock);
+  queue->current_open = false;
+  if (queue->current_remaining == 0) queue->current = -1;
+  for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+    ss_send_class *send_class = &queue->classes[i];
+    if (send_class->open_length == 0) continue;
+    ss_send_class_push(send_class, send_class->open_length);
+    send_class->open_length = 0;
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/* ss_send_queue_pending - Count the bytes queued in every class
+ */
+unsigned int ss_send_queue_pending(ss_send_queue *queue)
+{
+  int i = 0;
+  unsigned int pending = 0;
+  pthread_mutex_lock(&queue->lock);
+  for (i = 0; i < SS_PRIORITY_COUNT; ++i) pending = pending + queue->classes[i].buffer.index;
+  pthread_mutex_unlock(&queue->lock);
+  return pending;
+}
+
+/* ss_bulk_allowance - How many more bulk bytes may go to the kernel right now
+ */
+static int ss_bulk_allowance(const ss_send_policy *policy, int socket_fd)
+{
+  if (policy->bulk_in_flight == 0) return INT_MAX;
+  return policy->bulk_in_flight - ss_unsent(socket_fd);
+}
+
+/* ss_send_eligible - Check if a class has a complete message we may start, asking the kernel about bulk only when it matters
+ */
+static bool ss_send_eligible(ss_send_queue *queue, int priority, const ss_send_policy *policy, int socket_fd, int *allowance)
+{
+  if (queue->classes[priority].count == 0) return false;
+  if (priority != SS_PRIORITY_BULK) return true;
+  if (*allowance < 0) *allowance = ss_bulk_allowance(policy, socket_fd);
+  return *allowance > 0;
+}
+
+/* ss_send_pick_weighted - Deficit round robin over the classes with complete messages
+ * Every round tops each class that may send up by its weight in quanta, and a class sends once it has saved up for its next message.
+ * return - the class to send from, or -1 if none may send
+ */
+static int ss_send_pick_weighted(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd, int *allowance)
+{
+  int i = 0;
+  for (;;) {
+    bool waiting = false, eligible[SS_PRIORITY_COUNT];
+    for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+      int priority = (queue->next + i) % SS_PRIORITY_COUNT;
+      ss_send_class *send_class = &queue->classes[priority];
+      
+      // Idle classes do not get to save up for later
+      eligible[priority] = ss_send_eligible(queue, priority, policy, socket_fd, allowance);
+      if (eligible[priority] == false) {
+        if (send_class->count == 0) send_class->deficit = 0;
+        continue;
+      }
+      
+      waiting = true;
+      unsigned int length = send_class->lengths[send_class->head];
+      if ((unsigned int)send_class->deficit >= length) {
+        send_class->deficit = send_class->deficit - length;
+        queue->next = priority;
+        return priority;
+      }
+    }
+    if (waiting == false) return -1;
+    
+    // Nobody could afford their next message, start a new round. Bulk held back by the in flight limit sits the round out,
+    // and no class saves more than one round beyond its next message, so nothing comes back from a wait with a burst.
+    for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+      ss_send_class *send_class = &queue->classes[i];
+      if (eligible[i] == false) continue;
+      int64_t limit = (int64_t)policy->weights[i] * SS_SEND_QUANTUM + send_class->lengths[send_class->head];
+      int64_t deficit = (int64_t)send_class->deficit + (int64_t)policy->weights[i] * SS_SEND_QUANTUM;
+      send_class->deficit = (int)(deficit < limit ? deficit : limit);
+    }
+  }
+}
+
+/* ss_send_pick - Choose the class to send from next, starting a new message if the last one is done
+ * Must be called with the queue lock held.
+ * return - the class to send from, or -1 if nothing may be sent right now
+ */
+static int ss_send_pick(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd, int *allowance)
+{
+  int priority = -1;
+  
+  // A message on the wire is finished before anything else, classes must not interleave mid message
+  if (queue->current >= 0) {
+    if (queue->current_remaining == 0) return -1;
+    if (queue->current == SS_PRIORITY_BULK) {
+      if (*allowance < 0) *allowance = ss_bulk_allowance(policy, socket_fd);
+      if (*allowance <= 0) return -1;
+    }
+    return queue->current;
+  }
+  
+  // Start the next complete message
+  if (policy->strict) {
+    for (priority = 0; priority < SS_PRIORITY_COUNT; ++priority) {
+      if (ss_send_eligible(queue, priority, policy, socket_fd, allowance)) break;
+    }
+    if (priority == SS_PRIORITY_COUNT) priority = -1;
+  }
+  else {
+    priority = ss_send_pick_weighted(queue, policy, socket_fd, allowance);
+  }
+  if (priority >= 0) {
+    queue->current = priority;
+    queue->current_remaining = ss_send_class_pop(&queue->classes[priority]);
+    queue->current_open = false;
+    return priority;
+  }
+  
+  // With no complete message anywhere, start sending one that is still being written, most urgent first
+  for (priority = 0; priority < SS_PRIORITY_COUNT; ++priority) {
+    ss_send_class *send_class = &queue->classes[priority];
+    if (send_class->open_length == 0) continue;
+    if (priority == SS_PRIORITY_BULK) {
+      if (*allowance < 0) *allowance = ss_bulk_allowance(policy, socket_fd);
+      if (*allowance <= 0) return -1;
+    }
+    queue->current = priority;
+    queue->current_remaining = send_class->open_length;
+    queue->current_open = true;
+    send_class->open_length = 0;
+    return priority;
+  }
+  
+  return -1;
+}
+
+/* ss_send_queue_ready - Check if the queue has anything it may send right now, without starting a message
+ * @param throttled - If not NULL, set to true when bulk data is waiting on the in flight limit
+ * @return - true if the socket should be watched for writing
+ */
+bool ss_send_queue_ready(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd, bool *throttled)
+{
+  int priority = 0;
+  bool ready = false, bulk_waiting = false, bulk_current = false;
+  
+  pthread_mutex_lock(&queue->lock);
+  if (queue->current >= 0) {
+    ready = queue->current_remaining > 0;
+    bulk_current = bulk_waiting = ready && queue->current == SS_PRIORITY_BULK;
+  }
+  else {
+    for (priority = 0; priority < SS_PRIORITY_COUNT && ready == false; ++priority) {
+      ss_send_class *send_class = &queue->classes[priority];
+      if (send_class->count == 0 && send_class->open_length == 0) continue;
+      if (priority == SS_PRIORITY_BULK) bulk_waiting = true;
+      else ready = true;
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  
+  // Bulk data alone only counts while the kernel has room for it
+  if (bulk_waiting && (ready == false || bulk_current)) {
+    ready = ss_bulk_allowance(policy, socket_fd) > 0;
+    if (throttled != NULL && ready == false) *throttled = true;
+  }
+  
+  return ready;
+}
+
+/* ss_send_queue_flush - Send as many messages as the kernel will take, in the order the policy picks them
+ * @param queue - The send queue of the socket
+ * @param policy - The scheduling policy of the context
+ * @param socket_fd - The socket to send on
+ * @return - The number of bytes sent, or -1 on error
+ */
+int ss_send_queue_flush(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd)
+{
+  int priority = -1, total = 0;
+  
+  pthread_mutex_lock(&queue->lock);
+  for (;;) {
+    int allowance = -1;
+    priority = ss_send_pick(queue, policy, socket_fd, &allowance);
+    if (priority < 0) break;
+    
+    // Bulk data only goes out as far as the in flight limit allows
+    unsigned int size = queue->current_remaining;
+    if (priority == SS_PRIORITY_BULK && allowance >= 0 && (unsigned int)allowance < size) size = allowance;
+    
+    int len = ss_send(socket_fd, &queue->classes[priority].buffer, size);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) total = -1;
+      break;
+    }
+    
+    queue->current_remaining = queue->current_remaining - len;
+    if (queue->current_remaining == 0 && queue->current_open == false) queue->current = -1;
+    total = total + len;
+    
+    // The kernel is full, wait for the socket to turn writable again
+    if ((unsigned int)len < size) break;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  
+  return total;
+}
+
+/* ss_send_queue_shrink - Give back memory from the class buffers that have been quiet for long enough
+ * @return - true if any class buffer is still above the smallest size class
+ */
+bool ss_send_queue_shrink(ss_send_queue *queue, uint64_t now)
+{
+  int i = 0;
+  bool oversized = false;
+  for (i = 0; i < SS_PRIORITY_COUNT; ++i) {
+    if (ss_shrink(&queue->classes[i].buffer, now)) oversized = true;
+  }
+  return oversized;
+}
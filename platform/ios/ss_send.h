@@ -0,0 +1,58 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_send_h_
+#define ss_send_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ss_socket.h"
+
+// Bytes a class may send per unit of weight in each round of the weighted scheduler
+#define SS_SEND_QUANTUM 4096
+#define SS_SEND_MAX_WEIGHT 1024
+#define SS_SEND_BULK_IN_FLIGHT 65536
+
+/* ss_send_policy - How the send queues of every socket in a context are flushed
+ */
+typedef struct {
+  bool strict;                      // Always send the most urgent class first, instead of sharing by weight
+  int weights[SS_PRIORITY_COUNT];   // Relative share of each class under the weighted scheduler
+  int bulk_in_flight;               // Bulk bytes allowed in the kernel send queue at once, 0 for no limit
+} ss_send_policy;
+
+void ss_send_policy_init(ss_send_policy *policy);
+void ss_send_policy_configure(ss_send_policy *policy, bool strict, int control_weight, int normal_weight, int bulk_weight, int bulk_in_flight);
+
+void ss_send_queue_init(ss_send_queue *queue, ss_budget *budget);
+void ss_send_queue_destroy(ss_send_queue *queue);
+int ss_send_queue_growth(ss_send_queue *queue, ss_priority priority, unsigned int size);
+int ss_send_queue_write(ss_send_queue *queue, ss_priority priority, const unsigned char *data, unsigned int size, bool end);
+void ss_send_queue_end(ss_send_queue *queue);
+unsigned int ss_send_queue_pending(ss_send_queue *queue);
+bool ss_send_queue_ready(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd, bool *throttled);
+int ss_send_queue_flush(ss_send_queue *queue, const ss_send_policy *policy, int socket_fd);
+bool ss_send_queue_shrink(ss_send_queue *queue, uint64_t now);
+
+#endif
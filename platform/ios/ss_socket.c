@@ -21,36 +21,145 @@
  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <memory.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
 #include "ss_socket.h"
+#include "ss_send.h"
+#include "ss_capture.h"
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+/* ss_budget_init - Initialize a budget with no limit and the default idle period
+ */
+void ss_budget_init(ss_budget *budget)
+{
+  budget->used = budget->peak = 0;
+  budget->limit = 0;
+  budget->idle_ns = SS_BUDGET_IDLE_MS * 1000000ULL;
+}
+
+/* ss_budget_exhausted - Check if a budget can cover more memory
+ * @param budget - The budget to check
+ * @param size - The number of bytes we would like to allocate
+ * @return - true if allocating size bytes would go over the limit
+ */
+bool ss_budget_exhausted(ss_budget *budget, int64_t size)
+{
+  return budget->limit > 0 && budget->used + size > budget->limit;
+}
+
+/* ss_budget_charge - Account for memory allocated or freed against a budget
+ */
+static void ss_budget_charge(ss_budget *budget, int64_t size)
+{
+  int64_t used = __sync_add_and_fetch(&budget->used, size);
+  
+  // Raise the peak without a lock, retrying if another thread beat us to it
+  int64_t peak = budget->peak;
+  while (used > peak && __sync_bool_compare_and_swap(&budget->peak, peak, used) == false) {
+    peak = budget->peak;
+  }
+}
+
+/* ss_size_class - Round a size up to the power of two size class a buffer holding it would use
+ */
+static int ss_size_class(unsigned int size)
+{
+  unsigned int size_class = SS_BUFFER_SIZE;
+  while (size_class < size) size_class = size_class << 1;
+  return (int)size_class;
+}
+
+/* ss_resize - Grow or shrink a buffer, keeping its contents
+ * Must be called with the buffer lock held.
+ */
+static void ss_resize(ss_buffer *buffer, int size)
+{
+  unsigned char *new_buffer = realloc(buffer->buffer, size);
+  assert(new_buffer != NULL);
+  
+  ss_budget_charge(buffer->budget, size - buffer->size);
+  buffer->buffer = new_buffer;
+  buffer->size = size;
+}
+
+/* ss_buffer_init - Set up an empty buffer
+ * @param buffer - The buffer to set up
+ * @param budget - The budget the buffer is accounted against
+ * @param size - The size to allocate up front, 0 to wait for the first write
+ */
+void ss_buffer_init(ss_buffer *buffer, ss_budget *budget, int size)
+{
+  buffer->index = 0;
+  buffer->size = size;
+  pthread_mutex_init(&buffer->lock, NULL);
+  buffer->buffer = size > 0 ? malloc(size) : NULL;
+  assert(size == 0 || buffer->buffer != NULL);
+  buffer->budget = budget;
+  buffer->last_active = ss_clock_ns();
+  ss_budget_charge(budget, buffer->size);
+}
+
+/* ss_buffer_destroy - Free a buffer and give its memory back to the budget
+ */
+void ss_buffer_destroy(ss_buffer *buffer)
+{
+  ss_budget_charge(buffer->budget, -buffer->size);
+  free(buffer->buffer);
+  buffer->buffer = NULL;
+  buffer->index = buffer->size = 0;
+  pthread_mutex_destroy(&buffer->lock);
+}
 
 /* ss_alloc - Allocate memory for our buffers and initialize the struct with a file descriptor
+ * @param socket_fd - The socket descriptor
+ * @param budget - The budget the buffers of this socket are accounted against
  */
-ss_socket* ss_alloc(int socket_fd)
+ss_socket* ss_alloc(int socket_fd, ss_budget *budget)
 {
   // Allocate memory for this socket
   ss_socket* socket = malloc(sizeof(ss_socket));
   assert(socket != NULL);
   
-  // Set our socket descriptor
+  // Set our socket descriptor, sockets start out as connected inbound connections
   socket->socket_desc = socket_fd;
+  socket->state = SS_SOCKET_CONNECTED;
+  socket->is_outbound = false;
+  socket->keep_alive = false;
+  memset(&socket->remote_address, 0, sizeof(socket->remote_address));
+  socket->http = NULL;
+  socket->notify_close = false;
+  socket->peer_closed = false;
+  socket->discard_input = false;
+  socket->linger_until = 0;
   
-  // Initialize our read buffer
-  socket->read_buffer.index = 0;
-  socket->read_buffer.size = SS_BUFFER_SIZE;
-  pthread_mutex_init(&socket->read_buffer.lock, NULL);
-  socket->read_buffer.buffer = malloc(SS_BUFFER_SIZE);
-  assert(socket->read_buffer.buffer != NULL);
+  // Initialize our read buffer and send queues
+  ss_buffer_init(&socket->read_buffer, budget, SS_BUFFER_SIZE);
+  ss_send_queue_init(&socket->send_queue, budget);
   
-  // Initialie our write buffer
-  socket->write_buffer.index = 0;
-  socket->write_buffer.size = SS_BUFFER_SIZE;
-  pthread_mutex_init(&socket->write_buffer.lock, NULL);
-  socket->write_buffer.buffer = malloc(SS_BUFFER_SIZE);
-  assert(socket->write_buffer.buffer != NULL);
+  // Start with empty trace queues
+  memset(&socket->recv_trace, 0, sizeof(socket->recv_trace));
+  memset(&socket->send_trace, 0, sizeof(socket->send_trace));
   
   return socket;
 }
@@ -62,22 +171,50 @@ void ss_free(ss_socket *socket)
   // Invalidate our socket descriptor
   socket->socket_desc = -1;
   
-  // Free the read buffer
-  free(socket->read_buffer.buffer);
-  socket->read_buffer.buffer = NULL;
-  socket->read_buffer.index = socket->read_buffer.size = 0;
-  pthread_mutex_destroy(&socket->read_buffer.lock);
-  
-  // Free the write buffer
-  free(socket->write_buffer.buffer);
-  socket->write_buffer.buffer = NULL;
-  socket->write_buffer.index = socket->write_buffer.size = 0;
-  pthread_mutex_destroy(&socket->write_buffer.lock);
+  // Free the read buffer and send queues
+  ss_buffer_destroy(&socket->read_buffer);
+  ss_send_queue_destroy(&socket->send_queue);
+  free(socket->http);
   
   // Free the memory for this socket
   free(socket);
 }
 
+/* ss_shrink - Shrink a buffer down to the smallest size class that fits its contents once it has been quiet long enough
+ * Skips the buffer rather than waiting if another thread is using it.
+ * @param buffer - The buffer to shrink
+ * @param now - The current ss_clock_ns()
+ * @return - true if the buffer is still above the smallest size class, and needs checking on again later
+ */
+bool ss_shrink(ss_buffer *buffer, uint64_t now)
+{
+  // Nothing to give back
+  if (buffer->size <= SS_BUFFER_SIZE) return false;
+  if (pthread_mutex_trylock(&buffer->lock) != 0) return true;
+  
+  int size = ss_size_class(buffer->index);
+  if (size < buffer->size && now - buffer->last_active >= buffer->budget->idle_ns) {
+    ss_resize(buffer, size);
+  }
+  
+  bool oversized = buffer->size > SS_BUFFER_SIZE;
+  pthread_mutex_unlock(&buffer->lock);
+  return oversized;
+}
+
+/* ss_buffer_growth - Work out how much a buffer would grow to take more data
+ * @param buffer - The buffer that would take the data
+ * @param size - The size of the data
+ * @return - The number of bytes the buffer would grow by, 0 if the data already fits
+ */
+int ss_buffer_growth(ss_buffer *buffer, unsigned int size)
+{
+  pthread_mutex_lock(&buffer->lock);
+  int growth = size > (unsigned int)(buffer->size - buffer->index) ? ss_size_class(buffer->index + size) - buffer->size : 0;
+  pthread_mutex_unlock(&buffer->lock);
+  return growth;
+}
+
 /* ss_write - Write data into the target buffer, grow the buffer as needed to fit the data
  * @param buffer - The target buffer to write to
  * @param data - The data to write into the target buffer
@@ -86,30 +223,19 @@ void ss_free(ss_socket *socket)
  */
 int ss_write(ss_buffer *buffer, const unsigned char *data, unsigned int size)
 {
-  int grow_size = 0;
-  unsigned char *new_buffer = NULL;
-  
   // Lock our buffer
   pthread_mutex_lock(&buffer->lock);
   
-  // Grow our buffer to fit the data if needed
+  // Grow our buffer to the size class that fits the data if needed
   if (size > (buffer->size - buffer->index)) {
-    // Allocate a new buffer on SS_BUFFER_SIZE boundaries
-    grow_size = ((size / SS_BUFFER_SIZE) + 1) * SS_BUFFER_SIZE;
-    new_buffer = malloc(grow_size);
-    assert(new_buffer != NULL);
-    
-    // Copy the buffer and replace it with our new buffer
-    memcpy(new_buffer, buffer->buffer, buffer->size);
-    free(buffer->buffer);
-    buffer->buffer = new_buffer;
-    buffer->size = grow_size;
+    ss_resize(buffer, ss_size_class(buffer->index + size));
   }
   
   // Write the data into our buffer
   memcpy(&buffer->buffer[buffer->index], data, size);
   buffer->index = buffer->index + size;
-  assert(buffer->index < buffer->size);
+  buffer->last_active = ss_clock_ns();
+  assert(buffer->index <= buffer->size);
   
   // Unlock our buffer
   pthread_mutex_unlock(&buffer->lock);
@@ -131,13 +257,15 @@ int ss_read(ss_buffer *buffer, unsigned char *data, unsigned int size)
   pthread_mutex_lock(&buffer->lock);
   
   // If we are attempting to read more data then we have read as much as we have
-  if (read_length > (buffer->size - buffer->index)) {
-    read_length = buffer->size - buffer->index;
+  if (read_length > buffer->index) {
+    read_length = buffer->index;
   }
   
-  // Copy the data out of the buffer, and adjust the index
+  // Copy the data out of the buffer, then move any remaining bytes back to the beginning of the buffer
   memcpy(data, buffer->buffer, read_length);
   buffer->index = buffer->index - read_length;
+  if (buffer->index > 0) memmove(buffer->buffer, &buffer->buffer[read_length], buffer->index);
+  buffer->last_active = ss_clock_ns();
   assert(buffer->index >= 0);
   
   // Unlock our buffer
@@ -146,33 +274,149 @@ int ss_read(ss_buffer *buffer, unsigned char *data, unsigned int size)
   return read_length;
 }
 
-int ss_recv(int socket_fd, ss_buffer *buffer, unsigned int size)
+/* ss_accept - Accept a pending connection as a non-blocking, close-on-exec socket
+ * Uses accept4 where the platform has it to save the extra fcntl calls.
+ * @param listen_fd - The listening socket
+ * @param address - Receives the address of the peer
+ * @param address_len - The size of address, receives the size of the peer address
+ * @return - The new socket descriptor, or -1 with errno set
+ */
+int ss_accept(int listen_fd, struct sockaddr *address, socklen_t *address_len)
+{
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+  return accept4(listen_fd, address, address_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int socket_fd = accept(listen_fd, address, address_len);
+  if (socket_fd < 0) return -1;
+  
+  if (fcntl(socket_fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(socket_fd, F_SETFD, FD_CLOEXEC) < 0) {
+    int error = errno;
+    close(socket_fd);
+    errno = error;
+    return -1;
+  }
+  
+#ifdef SO_NOSIGPIPE
+  // Writing to a socket the peer has closed should fail with EPIPE, not kill the app
+  int opt_val = 1;
+  setsockopt(socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &opt_val, sizeof(opt_val));
+#endif
+  
+  return socket_fd;
+#endif
+}
+
+/* ss_busy_poll - Have the kernel busy poll the device queue on blocking reads and selects of a socket (Linux only)
+ * @param socket_fd - The socket descriptor
+ * @param usec - How long to busy poll for, 0 turns it off
+ */
+void ss_busy_poll(int socket_fd, int usec)
+{
+#ifdef SO_BUSY_POLL
+  setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#endif
+}
+
+/* ss_connect - Start a non-blocking connection to a remote address
+ * The connect completes in the background, the socket turns writable once it has succeeded or failed.
+ * @param address - The address to connect to
+ * @return - The new socket descriptor, or -1 with errno set
+ */
+int ss_connect(const struct sockaddr_in *address)
+{
+  int opt_val = 1, error = 0;
+  int socket_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (socket_fd < 0) return -1;
+  
+  if (fcntl(socket_fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(socket_fd, F_SETFD, FD_CLOEXEC) < 0) goto ss_connect_error;
+  
+#ifdef SO_NOSIGPIPE
+  // Writing to a socket the peer has closed should fail with EPIPE, not kill the app
+  setsockopt(socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &opt_val, sizeof(opt_val));
+#endif
+  
+  // Our traffic is small messages, do not hold them back waiting for acks
+  setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val));
+  
+  if (connect(socket_fd, (const struct sockaddr *)address, sizeof(*address)) < 0 && errno != EINPROGRESS) goto ss_connect_error;
+  
+  return socket_fd;
+  
+ss_connect_error:
+  error = errno;
+  close(socket_fd);
+  errno = error;
+  return -1;
+}
+
+/* ss_kernel_timestamp - Pull the kernel receive timestamp out of the control messages of a recvmsg
+ * @return - Wall clock nanoseconds, or 0 if the kernel did not timestamp the data
+ */
+static uint64_t ss_kernel_timestamp(struct msghdr *msg)
+{
+  struct cmsghdr *cmsg = NULL;
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) continue;
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+    // The software timestamp is the first of the three we get back
+    if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+      struct timespec stamp;
+      memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+      if (stamp.tv_sec != 0) return (uint64_t)stamp.tv_sec * 1000000000ULL + (uint64_t)stamp.tv_nsec;
+    }
+#endif
+#ifdef SCM_TIMESTAMP
+    if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+      struct timeval stamp;
+      memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+      return (uint64_t)stamp.tv_sec * 1000000000ULL + (uint64_t)stamp.tv_usec * 1000ULL;
+    }
+#endif
+  }
+  return 0;
+}
+
+/* ss_recv - Receive data from the socket into the target buffer, grow the buffer as needed to fit the data
+ * @param socket_fd - The socket to receive from
+ * @param buffer - The target buffer to write to
+ * @param size - The maximum number of bytes to receive
+ * @param kernel_time - If not NULL, receives the kernel timestamp of the data (see ss_trace_enable_socket)
+ * @return - The number of bytes received, 0 if the peer closed the connection, or -1 on error
+ */
+int ss_recv(int socket_fd, ss_buffer *buffer, unsigned int size, uint64_t *kernel_time)
 {
-  int grow_size = 0;
-  unsigned char *new_buffer = NULL;
+  struct iovec iov;
+  struct msghdr msg;
+  unsigned char control[256];
   
   // Lock our buffer
   pthread_mutex_lock(&buffer->lock);
   
-  // Grow our buffer to fit the data if needed
+  // Grow our buffer to the size class that fits the data if needed
   if (size > (buffer->size - buffer->index)) {
-    // Allocate a new buffer on SS_BUFFER_SIZE boundaries
-    grow_size = ((size / SS_BUFFER_SIZE) + 1) * SS_BUFFER_SIZE;
-    new_buffer = malloc(grow_size);
-    assert(new_buffer != NULL);
-    
-    // Copy the buffer and replace it with our new buffer
-    memcpy(new_buffer, buffer->buffer, buffer->size);
-    free(buffer->buffer);
-    buffer->buffer = new_buffer;
-    buffer->size = grow_size;
+    ss_resize(buffer, ss_size_class(buffer->index + size));
+  }
+  
+  // Describe where the data goes, and ask for the control messages only if we want the timestamp
+  iov.iov_base = &buffer->buffer[buffer->index];
+  iov.iov_len = size;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (kernel_time != NULL) {
+    *kernel_time = 0;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
   }
   
   // Read the data into our buffer (if we actually get data adjust the buffer
-  int len = (int)recv(socket_fd, &buffer->buffer[buffer->index], size, 0);
+  int len = (int)recvmsg(socket_fd, &msg, 0);
+  if (len > 0 && kernel_time != NULL) *kernel_time = ss_kernel_timestamp(&msg);
   if (len > 0) {
+    ss_capture_write(SS_CAPTURE_RECV, socket_fd, &buffer->buffer[buffer->index], len);
     buffer->index = buffer->index + len;
-    assert(buffer->index < buffer->size);
+    buffer->last_active = ss_clock_ns();
+    assert(buffer->index <= buffer->size);
   }
   
   // Unlock our buffer
@@ -182,18 +426,28 @@ int ss_recv(int socket_fd, ss_buffer *buffer, unsigned int size)
   return len;
 }
 
-int ss_send(int socket_fd, ss_buffer *buffer)
+/* ss_send - Send data from the front of the target buffer
+ * @param socket_fd - The socket to send on
+ * @param buffer - The buffer to send from
+ * @param size - The most bytes to send
+ * @return - The number of bytes sent, or -1 on error
+ */
+int ss_send(int socket_fd, ss_buffer *buffer, unsigned int size)
 {
   // Lock our buffer
   pthread_mutex_lock(&buffer->lock);
   
-  // Attempt to send all the bytes in our buffer
-  int len = send(socket_fd, buffer->buffer, (ssize_t)buffer->index, 0);
+  // Attempt to send up to size bytes of our buffer
+  if (size > (unsigned int)buffer->index) size = buffer->index;
+  int len = (int)send(socket_fd, buffer->buffer, size, 0);
   if (len > 0) {
+    ss_capture_write(SS_CAPTURE_SEND, socket_fd, buffer->buffer, len);
+    
     // If we have any remaining bytes, then move the memory back to the beginning of the buffer and set the index
     int bytes_left = buffer->index - len;
     if (bytes_left > 0) memmove(buffer->buffer, &buffer->buffer[len], bytes_left);
     buffer->index = bytes_left;
+    buffer->last_active = ss_clock_ns();
     assert(buffer->index >= 0);
   }
   
@@ -202,3 +456,34 @@ int ss_send(int socket_fd, ss_buffer *buffer)
   
   return len;
 }
+
+/* ss_unsent - Ask the kernel how many bytes are still waiting in the send queue of a socket
+ * @return - The number of bytes the peer has not acknowledged yet, or 0 where the platform can not tell us
+ */
+int ss_unsent(int socket_fd)
+{
+  int unsent = 0;
+#if defined(__linux__) && defined(SIOCOUTQ)
+  if (ioctl(socket_fd, SIOCOUTQ, &unsent) < 0) unsent = 0;
+#elif defined(SO_NWRITE)
+  socklen_t unsent_length = sizeof(unsent);
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_NWRITE, &unsent, &unsent_length) < 0) unsent = 0;
+#endif
+  return unsent;
+}
+
+/* ss_clock_ns - Monotonic clock in nanoseconds, used to timestamp socket activity
+ * @return - Nanoseconds since an arbitrary fixed point
+ */
+uint64_t ss_clock_ns(void)
+{
+#ifdef __APPLE__
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) mach_timebase_info(&timebase);
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
@@ -26,29 +26,121 @@
 #define ss_socket_h_
 
 #include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "ss_trace.h"
 
 #define SS_BUFFER_SIZE 1024
+#define SS_BUDGET_IDLE_MS 5000
+
+/* ss_budget - Memory accounting shared by every buffer of a context
+ */
+typedef struct {
+  volatile int64_t used;
+  volatile int64_t peak;
+  int64_t limit;        // Bytes all buffers may hold together, 0 for no limit
+  uint64_t idle_ns;     // Quiet period before a buffer is shrunk back down to fit its contents
+} ss_budget;
 
 typedef struct {
   int index;
   int size;
   pthread_mutex_t lock;
   unsigned char *buffer;
+  ss_budget *budget;
+  uint64_t last_active; // ss_clock_ns() of the last time data moved through the buffer
 } ss_buffer;
 
+/* ss_priority - Send classes, lower values are more urgent
+ */
+typedef enum {
+  SS_PRIORITY_CONTROL = 0,  // Small urgent messages, input acknowledgements and the like
+  SS_PRIORITY_NORMAL,       // Everything that does not ask for a class
+  SS_PRIORITY_BULK,         // Snapshots and asset chunks, limited in how much may sit in the kernel at once
+  SS_PRIORITY_COUNT
+} ss_priority;
+
+/* ss_send_class - The messages queued for one priority class of a socket
+ */
+typedef struct {
+  ss_buffer buffer;
+  unsigned int *lengths;      // Ring of the lengths of complete messages in the buffer, oldest first
+  int head, count, capacity;
+  unsigned int open_length;   // Bytes at the end of the buffer from a message that is still being written
+  int deficit;                // Bytes this class may still send in the current round of the weighted scheduler
+} ss_send_class;
+
+/* ss_send_queue - Per class send queues of a socket, flushed a message at a time so classes never interleave mid message
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  ss_send_class classes[SS_PRIORITY_COUNT];
+  int current;                    // Class of the message being sent, -1 between messages
+  unsigned int current_remaining; // Bytes of that message still in its buffer
+  bool current_open;              // The message being sent is still being written
+  int next;                       // Class the weighted scheduler starts its next round with
+} ss_send_queue;
+
+typedef enum {
+  SS_SOCKET_CONNECTED = 0,
+  SS_SOCKET_CONNECTING,   // Outbound connection waiting on the connect to complete
+  SS_SOCKET_CLOSING       // Closed by the AS layer (or the HTTP layer), waiting for the reactor to flush and release it
+} ss_socket_state;
+
 typedef struct {
   int socket_desc;
+  ss_socket_state state;
+  
+  // Outbound connections remember where they go so they can be pooled when closed
+  bool is_outbound;
+  bool keep_alive;
+  struct sockaddr_in remote_address;
+  
   ss_buffer read_buffer;
-  ss_buffer write_buffer;
+  ss_send_queue send_queue;
+  
+  // Sockets from HTTP listeners parse their requests on the IO thread
+  struct ss_http_request *http;
+  
+  // Set when the reactor closes the socket itself, rather than the AS layer, so the AS layer still hears about it
+  bool notify_close;
+  
+  // The peer finished sending, HTTP sockets stay open until the requests it sent before that are answered
+  bool peer_closed;
+  
+  // Set on HTTP sockets closing after an error response, their input is thrown away until linger_until (ss_clock_ns())
+  // so a client still uploading reads the response instead of a reset
+  bool discard_input;
+  uint64_t linger_until;
+  
+  // Timestamps of chunks in flight between the reactor and the AS layer, only filled while tracing
+  ss_trace_queue recv_trace;
+  ss_trace_queue send_trace;
 } ss_socket;
 
-ss_socket* ss_alloc(int socket_fd);
+void ss_budget_init(ss_budget *budget);
+bool ss_budget_exhausted(ss_budget *budget, int64_t size);
+
+ss_socket* ss_alloc(int socket_fd, ss_budget *budget);
 void ss_free(ss_socket *socket);
 
+void ss_buffer_init(ss_buffer *buffer, ss_budget *budget, int size);
+void ss_buffer_destroy(ss_buffer *buffer);
+bool ss_shrink(ss_buffer *buffer, uint64_t now);
+int ss_buffer_growth(ss_buffer *buffer, unsigned int size);
+
 int ss_write(ss_buffer *buffer, const unsigned char *data, unsigned int size);
 int ss_read(ss_buffer *buffer, unsigned char *data, unsigned int size);
 
-int ss_send(int socket_fd, ss_buffer *buffer);
-int ss_recv(int socket_fd, ss_buffer *buffer, unsigned int size);
+int ss_accept(int listen_fd, struct sockaddr *address, socklen_t *address_len);
+void ss_busy_poll(int socket_fd, int usec);
+int ss_connect(const struct sockaddr_in *address);
+int ss_send(int socket_fd, ss_buffer *buffer, unsigned int size);
+int ss_unsent(int socket_fd);
+int ss_recv(int socket_fd, ss_buffer *buffer, unsigned int size, uint64_t *kernel_time);
+
+uint64_t ss_clock_ns(void);
 
 #endif
@@ -0,0 +1,96 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include "ss_thread.h"
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+/* ss_thread_set_affinity - Pin a thread to one CPU
+ * Apple platforms only take affinity as a hint, threads with the same tag are kept together and apart from the rest.
+ * @param thread - The thread to pin
+ * @param cpu - The CPU number, or -1 to let the scheduler pick again
+ * @return - 0 on success, otherwise an errno value
+ */
+int ss_thread_set_affinity(pthread_t thread, int cpu)
+{
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (cpu < 0) {
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &cpus);
+  }
+  else if (cpu < CPU_SETSIZE) {
+    CPU_SET(cpu, &cpus);
+  }
+  else {
+    return EINVAL;
+  }
+  return pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+#elif defined(__APPLE__)
+  thread_affinity_policy_data_t policy = { cpu < 0 ? THREAD_AFFINITY_TAG_NULL : cpu + 1 };
+  kern_return_t result = thread_policy_set(pthread_mach_thread_np(thread), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+  return result == KERN_SUCCESS || result == KERN_NOT_SUPPORTED ? 0 : EINVAL;
+#else
+  return ENOTSUP;
+#endif
+}
+
+/* ss_thread_set_priority - Move a thread to the round robin real time scheduler, or back to the default one
+ * @param thread - The thread to schedule
+ * @param priority - Priority above the lowest round robin priority, clamped to the highest, or 0 for the default scheduler
+ * @return - 0 on success, otherwise an errno value, usually EPERM without the rights to raise priority
+ */
+int ss_thread_set_priority(pthread_t thread, int priority)
+{
+  struct sched_param param;
+  
+  if (priority <= 0) {
+    // The middle of the range is the default priority everywhere we run
+    param.sched_priority = (sched_get_priority_min(SCHED_OTHER) + sched_get_priority_max(SCHED_OTHER)) / 2;
+    return pthread_setschedparam(thread, SCHED_OTHER, &param);
+  }
+  
+  int lowest = sched_get_priority_min(SCHED_RR), highest = sched_get_priority_max(SCHED_RR);
+  param.sched_priority = lowest + priority > highest ? highest : lowest + priority;
+  return pthread_setschedparam(thread, SCHED_RR, &param);
+}
+
+/* ss_thread_cpu_ns - CPU time used by the calling thread
+ * @return - Nanoseconds of user and system time
+ */
+uint64_t ss_thread_cpu_ns(void)
+{
+  struct timespec used;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &used) != 0) return 0;
+  return (uint64_t)used.tv_sec * 1000000000ULL + (uint64_t)used.tv_nsec;
+}
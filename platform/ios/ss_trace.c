@@ -0,0 +1,215 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include "ss_socket.h"
+#include "ss_trace.h"
+
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+// Tracing is process wide so every context feeds the same histograms
+static volatile bool trace_enabled = false;
+static ss_histogram trace_histograms[SS_TRACE_STAGE_COUNT];
+
+static const char* trace_stage_names[SS_TRACE_STAGE_COUNT] = {
+  "kernelToReactor",
+  "reactorToDispatch",
+  "dispatchToRead",
+  "reactorToRead",
+  "sendToTransmit"
+};
+
+/* ss_histogram_index - Map a value onto its histogram bucket
+ */
+static unsigned int ss_histogram_index(uint64_t value)
+{
+  if (value < SS_HISTOGRAM_SUB_BUCKETS) return (unsigned int)value;
+  
+  unsigned int shift = (63 - __builtin_clzll(value)) - SS_HISTOGRAM_SUB_BUCKET_BITS;
+  unsigned int sub_bucket = (unsigned int)(value >> shift) & (SS_HISTOGRAM_SUB_BUCKETS - 1);
+  return ((shift + 1) << SS_HISTOGRAM_SUB_BUCKET_BITS) + sub_bucket;
+}
+
+/* ss_histogram_value - The midpoint of the values that map onto a histogram bucket
+ */
+static uint64_t ss_histogram_value(unsigned int index)
+{
+  if (index < SS_HISTOGRAM_SUB_BUCKETS) return index;
+  
+  unsigned int shift = (index >> SS_HISTOGRAM_SUB_BUCKET_BITS) - 1;
+  uint64_t sub_bucket = SS_HISTOGRAM_SUB_BUCKETS + (index & (SS_HISTOGRAM_SUB_BUCKETS - 1));
+  return (sub_bucket << shift) + ((1ULL << shift) >> 1);
+}
+
+void ss_trace_start(void)
+{
+  ss_trace_reset();
+  trace_enabled = true;
+}
+
+void ss_trace_stop(void)
+{
+  trace_enabled = false;
+}
+
+bool ss_trace_enabled(void)
+{
+  return trace_enabled;
+}
+
+/* ss_trace_reset - Clear every histogram, values recorded concurrently may be lost
+ */
+void ss_trace_reset(void)
+{
+  memset((void *)trace_histograms, 0, sizeof(trace_histograms));
+}
+
+/* ss_trace_enable_socket - Ask the kernel to timestamp data as it arrives on a socket
+ * Uses SO_TIMESTAMPING where the platform has it, and falls back to SO_TIMESTAMP.
+ */
+void ss_trace_enable_socket(int socket_fd)
+{
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+#elif defined(SO_TIMESTAMP)
+  int opt_val = 1;
+  setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMP, &opt_val, sizeof(opt_val));
+#endif
+}
+
+/* ss_trace_realtime_ns - Wall clock in nanoseconds, the clock kernel receive timestamps are taken on
+ */
+uint64_t ss_trace_realtime_ns(void)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_usec * 1000ULL;
+}
+
+/* ss_trace_record - Record a latency sample for a stage if tracing is enabled
+ * @param stage - The stage the latency was measured across
+ * @param latency - The latency in nanoseconds
+ */
+void ss_trace_record(ss_trace_stage stage, uint64_t latency)
+{
+  if (trace_enabled == false || stage >= SS_TRACE_STAGE_COUNT) return;
+  
+  ss_histogram *histogram = &trace_histograms[stage];
+  __sync_fetch_and_add(&histogram->counts[ss_histogram_index(latency)], 1);
+  __sync_fetch_and_add(&histogram->total, 1);
+  __sync_fetch_and_add(&histogram->sum, latency);
+  
+  // Raise the max without a lock, retrying if another thread beat us to it
+  uint64_t max = histogram->max;
+  while (latency > max && __sync_bool_compare_and_swap(&histogram->max, max, latency) == false) {
+    max = histogram->max;
+  }
+}
+
+const ss_histogram* ss_trace_histogram(ss_trace_stage stage)
+{
+  return &trace_histograms[stage];
+}
+
+const char* ss_trace_stage_name(ss_trace_stage stage)
+{
+  return trace_stage_names[stage];
+}
+
+/* ss_histogram_percentile - Find the value at a percentile of the recorded samples
+ * @param histogram - The histogram to search
+ * @param percentile - The percentile in the range of (0, 100)
+ * @return - The value in nanoseconds, or 0 if nothing was recorded
+ */
+uint64_t ss_histogram_percentile(const ss_histogram *histogram, double percentile)
+{
+  uint64_t total = histogram->total, count = 0;
+  unsigned int i;
+  if (total == 0) return 0;
+  
+  // Walk the buckets until we have seen enough samples
+  uint64_t target = (uint64_t)((percentile / 100.0) * total + 0.5);
+  if (target < 1) target = 1;
+  for (i = 0; i < SS_HISTOGRAM_BUCKETS; ++i) {
+    count = count + histogram->counts[i];
+    if (count >= target) break;
+  }
+  
+  // Never report beyond the largest value we actually saw
+  uint64_t value = ss_histogram_value(i);
+  return value > histogram->max ? histogram->max : value;
+}
+
+/* ss_trace_push - Queue the timestamps of a chunk for the consumer of the next stage
+ * Must only be called from the producing thread, for every chunk even while tracing is off, so the byte counts of both
+ * ends stay in step. The chunk goes untraced while tracing is off or the queue is full.
+ */
+void ss_trace_push(ss_trace_queue *queue, uint64_t queued, uint64_t dispatched, unsigned int size)
+{
+  queue->produced = queue->produced + size;
+  if (trace_enabled == false || size == 0) return;
+  if (queue->head - queue->tail >= SS_TRACE_QUEUE_SIZE) return;
+  
+  ss_trace_mark *mark = &queue->marks[queue->head % SS_TRACE_QUEUE_SIZE];
+  mark->queued = queued;
+  mark->dispatched = dispatched;
+  mark->end = queue->produced;
+  
+  // Publish the mark only after its contents are in place
+  __sync_synchronize();
+  queue->head = queue->head + 1;
+}
+
+/* ss_trace_consume - Retire size bytes worth of marks, recording the latency of each completed chunk
+ * Must only be called from the consuming thread, for every byte that moves on even while tracing is off.
+ * @param queue - The queue of marks
+ * @param size - The number of bytes that reached the next stage
+ * @param dispatched_stage - The stage measured from the dispatch timestamp, SS_TRACE_STAGE_COUNT for none
+ * @param queued_stage - The stage measured from the queued timestamp
+ */
+void ss_trace_consume(ss_trace_queue *queue, unsigned int size, ss_trace_stage dispatched_stage, ss_trace_stage queued_stage)
+{
+  queue->consumed = queue->consumed + size;
+  
+  // Only read the clock when there is something to retire
+  if (size == 0 || queue->tail == queue->head) return;
+  uint64_t now = ss_clock_ns();
+  
+  while (queue->tail != queue->head) {
+    ss_trace_mark *mark = &queue->marks[queue->tail % SS_TRACE_QUEUE_SIZE];
+    
+    // Only part of this chunk has made it through
+    if (mark->end > queue->consumed) return;
+    
+    if (dispatched_stage < SS_TRACE_STAGE_COUNT) ss_trace_record(dispatched_stage, now - mark->dispatched);
+    ss_trace_record(queued_stage, now - mark->queued);
+    
+    __sync_synchronize();
+    queue->tail = queue->tail + 1;
+  }
+}
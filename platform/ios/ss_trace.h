@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef ss_trace_h_
+#define ss_trace_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Linear sub-buckets per power of two, 16 keeps every bucket within ~6% of the recorded value
+#define SS_HISTOGRAM_SUB_BUCKET_BITS 4
+#define SS_HISTOGRAM_SUB_BUCKETS (1 << SS_HISTOGRAM_SUB_BUCKET_BITS)
+#define SS_HISTOGRAM_BUCKETS (64 * SS_HISTOGRAM_SUB_BUCKETS)
+
+// Chunks that can be waiting on the next stage per socket and direction before tracing skips them
+#define SS_TRACE_QUEUE_SIZE 64
+
+typedef enum {
+  SS_TRACE_KERNEL_TO_REACTOR = 0,  // Kernel receive timestamp to the reactor pulling the chunk off the socket
+  SS_TRACE_REACTOR_TO_DISPATCH,    // Reactor dequeue to the status event being handed to the runtime
+  SS_TRACE_DISPATCH_TO_READ,       // Status event dispatch to ActionScript reading the chunk
+  SS_TRACE_REACTOR_TO_READ,        // Reactor dequeue to ActionScript reading the chunk
+  SS_TRACE_SEND_TO_TRANSMIT,       // ActionScript send to the chunk being handed to the kernel
+  SS_TRACE_STAGE_COUNT
+} ss_trace_stage;
+
+/* ss_histogram - Log linear latency histogram in nanoseconds, safe to record into from any thread
+ */
+typedef struct {
+  volatile uint64_t counts[SS_HISTOGRAM_BUCKETS];
+  volatile uint64_t total;
+  volatile uint64_t sum;
+  volatile uint64_t max;
+} ss_histogram;
+
+/* ss_trace_mark - Timestamps of a chunk of data waiting on its next stage
+ */
+typedef struct {
+  uint64_t queued;
+  uint64_t dispatched;
+  uint64_t end;       // Stream offset just past the last byte of the chunk
+} ss_trace_mark;
+
+/* ss_trace_queue - Single producer, single consumer queue of marks for one direction of a socket
+ * Both ends count every byte, traced or not, so a chunk that could not be marked never gets charged to another.
+ */
+typedef struct {
+  volatile unsigned int head;
+  volatile unsigned int tail;
+  uint64_t produced;  // Bytes pushed, only touched by the producer
+  uint64_t consumed;  // Bytes consumed, only touched by the consumer
+  ss_trace_mark marks[SS_TRACE_QUEUE_SIZE];
+} ss_trace_queue;
+
+void ss_trace_start(void);
+void ss_trace_stop(void);
+bool ss_trace_enabled(void);
+void ss_trace_reset(void);
+
+void ss_trace_enable_socket(int socket_fd);
+uint64_t ss_trace_realtime_ns(void);
+
+void ss_trace_record(ss_trace_stage stage, uint64_t latency);
+const ss_histogram* ss_trace_histogram(ss_trace_stage stage);
+const char* ss_trace_stage_name(ss_trace_stage stage);
+uint64_t ss_histogram_percentile(const ss_histogram *histogram, double percentile);
+
+void ss_trace_push(ss_trace_queue *queue, uint64_t queued, uint64_t dispatched, unsigned int size);
+void ss_trace_consume(ss_trace_queue *queue, unsigned int size, ss_trace_stage dispatched_stage, ss_trace_stage queued_stage);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+package com.thejustinwalsh.net
+{
+	import flash.events.Event;
+	import flash.net.Socket;
+	import flash.utils.ByteArray;
+
+	// Dispatched by a ServerSocket for every request on an http listener, write the complete response to the socket
+	// and flush it once. Requests pipelined behind this one wait until the response is flushed.
+	public class HTTPRequestEvent extends Event
+	{
+		public static const HTTP_REQUEST:String = "httpRequest";
+		
+		public var socket:Socket;
+		public var method:String;
+		public var path:String;
+		public var version:String;
+		
+		// Header values by lower case name, repeated headers are joined with commas
+		public var headers:Object;
+		
+		// The request body, chunked bodies arrive already decoded
+		public var body:ByteArray;
+		
+		// False when the connection closes after the response
+		public var keepAlive:Boolean;
+		
+		public function HTTPRequestEvent(type:String, socket:Socket = null, method:String = null, path:String = null, version:String = null, headers:Object = null, body:ByteArray = null, keepAlive:Boolean = true)
+		{
+			super(type, false, false);
+			this.socket = socket;
+			this.method = method;
+			this.path = path;
+			this.version = version;
+			this.headers = headers;
+			this.body = body;
+			this.keepAlive = keepAlive;
+		}
+		
+		override public function clone():Event
+		{
+			return new HTTPRequestEvent(type, socket, method, path, version, headers, body, keepAlive);
+		}
+	}
+}
@@ -104,6 +104,18 @@ package com.thejustinwalsh.net
 		}
 
 		override public function listen(backlog:int = 0):void
+		{
+			listenWithOptions(backlog, null);
+		}
+		
+		// Listen with low latency options for the IO thread, every option is optional:
+		//   busyPoll - microseconds to keep polling for activity before the IO thread goes to sleep
+		//   socketBusyPoll - microseconds the kernel busy polls the network device for our sockets (SO_BUSY_POLL, Linux only)
+		//   cpu - the core to pin the IO thread to, -1 to let it float
+		//   priority - real time priority of the IO thread above the lowest, 0 for the default scheduler
+		//   http - parse HTTP/1.1 requests on the IO thread and dispatch an HTTPRequestEvent per request instead of socket data
+		// All servers share one IO thread, so busyPoll, cpu and priority apply to every server in the process.
+		public function listenWithOptions(backlog:int, options:Object):void
 		{
 			// Verify our backlog is within range
 			if (backlog < 0) {
@@ -121,7 +133,7 @@ package com.thejustinwalsh.net
 			}
 			
 			// Attempt to listen for incoming connections
-			var result:Object = _extContext.call("listen", backlog);
+			var result:Object = _extContext.call("listen", backlog, options);
 			if (result.success == true)
 			{
 				_listening = true;
@@ -132,6 +144,132 @@ package com.thejustinwalsh.net
 			}
 		}
 		
+		// Accept connections on another port as well, connections from every port arrive through the same connect
+		// event and socket.localPort tells them apart. All servers in the process share one IO thread however
+		// many ports they listen on. Takes the same options as listenWithOptions. Returns the port that was bound.
+		public function addListener(localPort:int = 0, localAddress:String = "0.0.0.0", backlog:int = 0, options:Object = null):int
+		{
+			// Verify that our localPort is within range
+			if (localPort < 0 || localPort > 65535) {
+				throw new RangeError("Parameter localPort must be a valid port in the range of (0, 65535)");
+			}
+			
+			// Verify that the socket is not closed
+			if (_closed) {
+				throw new IOError("Socket is closed");
+			}
+			
+			var result:Object = _extContext.call("addListener", localPort, localAddress, backlog, options);
+			if (result.success != true) {
+				throw new IOError(result.error);
+			}
+			return result.localPort;
+		}
+		
+		// Stop accepting connections on a port added with addListener, sockets it already accepted stay open
+		public function removeListener(localPort:int):void
+		{
+			_extContext.call("removeListener", localPort);
+		}
+		
+		// Open an outbound connection that is serviced by this server's IO thread, the socket dispatches
+		// Event.CONNECT once the connection is established or an IOErrorEvent if it fails
+		public function connect(host:String, port:int):Socket
+		{
+			var socket:Socket = new Socket();
+			_connect(socket, host, port);
+			return socket;
+		}
+		
+		// Keep up to maxIdlePerDestination closed keepAlive sockets open per destination for reuse by later connects,
+		// idle connections are dropped after idleTimeout milliseconds. 0 disables pooling.
+		public function configureConnectionPool(maxIdlePerDestination:int, idleTimeout:int = 30000):void
+		{
+			_extContext.call("connectionPool", maxIdlePerDestination, idleTimeout);
+		}
+		
+		// Limit how fast incoming connections are accepted, per source address and overall, connections over the
+		// limit are reset before any resources are spent on them. A rate of 0 removes the limit.
+		public function setAdmissionLimits(connectionsPerSecondPerAddress:Number = 0, burstPerAddress:int = 0, connectionsPerSecond:Number = 0, burst:int = 0):void
+		{
+			_extContext.call("admission", connectionsPerSecondPerAddress, burstPerAddress, connectionsPerSecond, burst);
+		}
+		
+		// Cap the memory all socket buffers of this server may hold, 0 for no limit. While the budget is tight new
+		// connections are refused, sockets holding unread data stop reading, and flushes that do not fit leave their
+		// data pending in the socket for the next flush. Buffers shrink back down once they have been quiet for
+		// idleTimeout milliseconds.
+		public function setMemoryBudget(bytes:Number, idleTimeout:int = 5000):void
+		{
+			_extContext.call("memoryBudget", bytes, idleTimeout);
+		}
+		
+		// Choose how the SendPriority classes of every socket share the link. Strict scheduling always sends the most
+		// urgent message first, otherwise classes take turns by weight. Classes only switch between messages, and at most
+		// bulkInFlight bytes of bulk data wait in the kernel at once so urgent messages are not stuck behind them (0 for no limit).
+		public function setSendScheduling(strict:Boolean = false, controlWeight:int = 8, normalWeight:int = 4, bulkWeight:int = 1, bulkInFlight:int = 65536):void
+		{
+			_extContext.call("sendScheduling", strict, controlWeight, normalWeight, bulkWeight, bulkInFlight);
+		}
+		
+		// Returns an object with the used, peak and limit bytes, and the number of open sockets
+		public function memoryUsage():Object
+		{
+			return _extContext.call("memoryUsage");
+		}
+		
+		// Capture every accept, close and chunk of socket data into a ring file that tools/ss_replay can play back,
+		// the capture is shared by all ServerSocket instances and keeps the most recent size bytes of activity
+		public function startCapture(path:String, size:int = 8388608):void
+		{
+			var result:Object = _extContext.call("startCapture", path, size);
+			if (result.success != true) {
+				throw new IOError(result.error);
+			}
+		}
+		
+		public function stopCapture():void
+		{
+			_extContext.call("stopCapture");
+		}
+		
+		// Timestamp every chunk of data from the kernel to the AS read, and from send to the kernel, into
+		// latency histograms shared by all ServerSocket instances
+		public function startTrace():void
+		{
+			_extContext.call("startTrace");
+		}
+		
+		public function stopTrace():void
+		{
+			_extContext.call("stopTrace");
+		}
+		
+		// Returns an object with a property per stage, each holding count, mean, p50, p90, p99, p999 and max in microseconds
+		public function traceStats(reset:Boolean = false):Object
+		{
+			return _extContext.call("traceStats", reset);
+		}
+		
+		// Returns an object with the cpu and wall milliseconds the shared IO thread has spent since the last reset,
+		// its cpu utilization, and how many times it polled and went to sleep
+		public function reactorStats(reset:Boolean = false):Object
+		{
+			return _extContext.call("reactorStats", reset);
+		}
+		
+		// Answer GET requests for path on http listeners with response straight from the IO thread, the response
+		// holds the complete status line, headers and body. Returns false if the cache is full.
+		public function setHttpCache(path:String, response:ByteArray):Boolean
+		{
+			return _extContext.call("httpCache", path, response) as Boolean;
+		}
+		
+		public function clearHttpCache(path:String):void
+		{
+			_extContext.call("httpCache", path, null);
+		}
+		
 		private function onContextEvent(e:StatusEvent):void
 		{
 			var code:String = e.code;
@@ -142,11 +280,14 @@ package com.thejustinwalsh.net
 			switch (code)
 			{
 				case "SocketOpened":
-					socketIndex = int(level);
+					var openedData:Array = level.split(',');
+					socketIndex = int(openedData[0]);
 					socket = new Socket();
 					
-					// Initialize our new socket
+					// Initialize our new socket, with the port of the listener that accepted it
 					socket._open(this, socketIndex);
+					socket._localPort = int(openedData[1]);
+					socket._http = openedData[2] == "1";
 					
 					// Hold on to our socket
 					_sockets[socketIndex] = socket;
@@ -155,11 +296,26 @@ package com.thejustinwalsh.net
 					dispatchEvent( new ServerSocketConnectEvent(ServerSocketConnectEvent.CONNECT, false, false, socket) );
 					break;
 				
+				case "SocketConnected":
+					socket = _sockets[int(level)];
+					if (socket != null) socket._connectionEstablished();
+					break;
+				
+				case "SocketConnectError":
+					var separator:int = level.indexOf(',');
+					socketIndex = int(level.substr(0, separator));
+					socket = _sockets[socketIndex];
+					
+					// The native layer has already released the socket, forget about it and report the failure
+					delete _sockets[socketIndex];
+					if (socket != null) socket._connectionFailed(level.substr(separator + 1));
+					break;
+				
 				case "SocketClosed":
 					socketIndex = int(level);
 					
 					// Close our socket and free it up
-					_close(socketIndex);
+					if (_sockets[socketIndex] != null) _close(socketIndex);
 					break;
 				
 				case "SocketDataReady":
@@ -168,8 +324,21 @@ package com.thejustinwalsh.net
 					socketIndex = int(levelData[0]);
 					socket = _sockets[socketIndex];
 					
-					// Inform our socket of the data
-					socket._dataReady(dataLength);
+					// Inform our socket of the data, data may still trail a socket that was just closed
+					if (socket != null) socket._dataReady(dataLength);
+					break;
+				
+				case "HttpRequest":
+					socketIndex = int(level);
+					socket = _sockets[socketIndex];
+					if (socket == null) break;
+					
+					// Take the parsed request from the native layer, the next flush on the socket is the response
+					var body:ByteArray = new ByteArray();
+					var request:Object = _extContext.call("httpRequest", socketIndex, body);
+					if (request != null) {
+						dispatchEvent( new HTTPRequestEvent(HTTPRequestEvent.HTTP_REQUEST, socket, request.method, request.path, request.version, request.headers, body, request.keepAlive) );
+					}
 					break;
 				
 				case "SocketIOError":
@@ -194,13 +363,57 @@ package com.thejustinwalsh.net
 			delete _sockets[socketIndex];
 		}
 		
-		internal function _send(socketIndex:int, data:ByteArray):void
+		internal function _closeSocket(socketIndex:int, keepAlive:Boolean):void
 		{
-			// Copy the data into the native network layer
-			_extContext.call("send", socketIndex, data);
+			// The native layer flushes any pending data before closing, or pooling the connection for reuse
+			_extContext.call("closeSocket", socketIndex, keepAlive);
 			
-			// Clear the data from the buffer
-			data.position = data.length = 0;
+			// A locally closed socket does not dispatch the close event
+			var socket:Socket = _sockets[socketIndex];
+			delete _sockets[socketIndex];
+			if (socket != null) socket._close(true);
+		}
+		
+		internal function _connect(socket:Socket, host:String, port:int):void
+		{
+			// Verify that the port is within range
+			if (port <= 0 || port > 65535) {
+				throw new RangeError("Parameter port must be a valid port in the range of (1, 65535)");
+			}
+			
+			// Verify that the server is not closed
+			if (_closed) {
+				throw new IOError("Socket is closed");
+			}
+			
+			// Attempt to open the connection, the result arrives as a SocketConnected or SocketConnectError event
+			var result:Object = _extContext.call("connect", host, port);
+			if (result.success == true)
+			{
+				socket._open(this, result.index, false);
+				_sockets[result.index] = socket;
+			}
+			else
+			{
+				throw new IOError(result.error);
+			}
+		}
+		
+		// Sockets that connect on their own share a single server context for their IO
+		internal static function get connector():ServerSocket
+		{
+			if (_connector == null) _connector = new ServerSocket();
+			return _connector;
+		}
+		
+		internal function _send(socketIndex:int, data:ByteArray, priority:int = 1, end:Boolean = true):int
+		{
+			// Copy the data into the native network layer, queued in its priority class
+			var bytesSent:int = _extContext.call("send", socketIndex, data, priority, end) as int;
+			
+			// Clear the data from the buffer, unless the memory budget refused it and it has to wait for the next flush
+			if (bytesSent > 0) data.position = data.length = 0;
+			return bytesSent;
 		}
 		
 		internal function _recv(socketIndex:int, data:ByteArray, dataLength:int):void
@@ -217,6 +430,8 @@ package com.thejustinwalsh.net
 			if (bytesRead < data.length - offset) data.length = offset + bytesRead;
 		}
 		
+		private static var _connector:ServerSocket;
+		
 		private var _extContext:ExtensionContext;
 		private var _sockets:Object = {};
 		private var _bound:Boolean = false;
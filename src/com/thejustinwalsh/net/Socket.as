@@ -24,6 +24,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 package com.thejustinwalsh.net
 {
 	import flash.events.Event;
+	import flash.events.IOErrorEvent;
 	import flash.events.OutputProgressEvent;
 	import flash.events.ProgressEvent;
 	import flash.net.Socket;
@@ -33,35 +34,66 @@ package com.thejustinwalsh.net
 	{
 		override public function get bytesAvailable():uint { return _readBuffer.bytesAvailable; }
 		override public function get bytesPending():uint { return _writeBuffer.position; }
-		override public function get connected():Boolean { return _socketIndex >= 0; }
+		override public function get connected():Boolean { return _connected; }
 		override public function get endian():String { return _readBuffer.endian; }
 		override public function set endian(value:String):void { _readBuffer.endian = _writeBuffer.endian = value; }
 		override public function get objectEncoding():uint { return _readBuffer.objectEncoding; }
 		override public function set objectEncoding(value:uint):void { _readBuffer.objectEncoding = _writeBuffer.objectEncoding = value; }
+		override public function get localPort():int { return _localPort; }
 		override public function get timeout():uint { return 0; }
 		override public function set timeout(time:uint):void { }
 		
+		// When set, closing an outbound socket returns the connection to the pool instead of closing it
+		public var keepAlive:Boolean = false;
+		
+		// The SendPriority class of the messages flushed from now on, change it between messages only
+		public var sendPriority:int = SendPriority.NORMAL;
+		
+		// Keep up to maxIdlePerDestination closed keepAlive sockets open per destination for reuse by later connects
+		public static function configureConnectionPool(maxIdlePerDestination:int, idleTimeout:int = 30000):void
+		{
+			ServerSocket.connector.configureConnectionPool(maxIdlePerDestination, idleTimeout);
+		}
+		
+		// Choose how the priority classes of outbound sockets share the link, see ServerSocket.setSendScheduling
+		public static function configureSendScheduling(strict:Boolean = false, controlWeight:int = 8, normalWeight:int = 4, bulkWeight:int = 1, bulkInFlight:int = 65536):void
+		{
+			ServerSocket.connector.setSendScheduling(strict, controlWeight, normalWeight, bulkWeight, bulkInFlight);
+		}
+		
 		public function Socket(host:String = null, port:int = 0)
 		{
 			super(null, 0);
 			_readBuffer = new ByteArray();
 			_writeBuffer = new ByteArray();
+			
+			if (host != null && port > 0) connect(host, port);
 		}
 		
-		override public function connect(host:String, port:int):void { }
+		override public function connect(host:String, port:int):void
+		{
+			// Reconnecting drops the current connection first
+			if (_parent != null) close();
+			ServerSocket.connector._connect(this, host, port);
+		}
 		
 		override public function close():void
 		{
-			if (connected == false) return;
-			_parent._close(_socketIndex);
+			if (_parent == null) return;
+			_parent._closeSocket(_socketIndex, keepAlive);
 		}
 		
 		override public function flush():void
+		{
+			flushMessage(true);
+		}
+		
+		// A flush ends a message, automatic flushes only send part of one, so other classes can not cut into it
+		private function flushMessage(end:Boolean):void
 		{
 			if (connected == false) return;
 			
-			var bytesSent:int = bytesPending;
-			_parent._send(_socketIndex, _writeBuffer);
+			var bytesSent:int = _parent._send(_socketIndex, _writeBuffer, sendPriority, end);
 			
 			if (bytesSent > 0) {
 				dispatchEvent( new OutputProgressEvent(OutputProgressEvent.OUTPUT_PROGRESS) );
@@ -100,19 +132,35 @@ package com.thejustinwalsh.net
 		
 		private function checkFlush():void
 		{
-			if (_writeBuffer.position > _writeTrigger) flush();
+			// A flush on an http socket is the whole response, so wait for the explicit one
+			if (_writeBuffer.position > _writeTrigger && !_http) flushMessage(false);
 		}
 		
-		internal function _open(parent:ServerSocket, index:int):void
+		internal function _open(parent:ServerSocket, index:int, connected:Boolean = true):void
 		{
 			_parent = parent;
 			_socketIndex = index;
+			_connected = connected;
+		}
+		
+		internal function _connectionEstablished():void
+		{
+			_connected = true;
+			dispatchEvent( new Event(Event.CONNECT) );
+		}
+		
+		internal function _connectionFailed(message:String):void
+		{
+			_parent = null;
+			_socketIndex = -1;
+			dispatchEvent( new IOErrorEvent(IOErrorEvent.IO_ERROR, false, false, message) );
 		}
 		
 		internal function _close(silent:Boolean = false):void
 		{
 			_parent = null;
 			_socketIndex = -1;
+			_connected = false;
 			
 			// If we are not being silenced dispatch the close event
 			if (!silent) dispatchEvent( new Event(Event.CLOSE) );
@@ -130,6 +178,13 @@ package com.thejustinwalsh.net
 		// These values are our contract with the ServerSocket for sending and recieving data
 		private var _parent:ServerSocket;
 		private var _socketIndex:int = -1;
+		private var _connected:Boolean = false;
+		
+		// The port of the listener that accepted us, set by the ServerSocket
+		internal var _localPort:int = 0;
+		
+		// Accepted by an http listener, set by the ServerSocket
+		internal var _http:Boolean = false;
 		
 		// We need two internal buffers for reading and writing too
 		private var _readBuffer:ByteArray;
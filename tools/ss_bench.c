@@ -0,0 +1,204 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* ss_bench - Measure round trip latency against an echo listener
+ *
+ * Build: cc -O2 -o ss_bench tools/ss_bench.c
+ * Usage: ss_bench <address> <port> [count] [size] [interval_us] [label] [server_pid]
+ *
+ * Sends count messages of size bytes, one at a time, waiting interval_us between them the way input
+ * arrives from a player, and waits for each to be echoed back. Prints one row of round trip percentiles
+ * in microseconds, with the CPU the bench and, given its pid, the server process burned per second of the
+ * run. The server picks its reactor mode itself, so run once per mode and the rows line up into a table.
+ * The server figure covers the whole process, its reactorStats() narrow that down to the IO thread.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach_time.h>
+#endif
+
+#define WARMUP 100
+#define MAX_SIZE 65536
+
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *samples, int count, double p)
+{
+  int index = (int)(p / 100.0 * (count - 1) + 0.5);
+  return samples[index] / 1000.0;
+}
+
+static double process_cpu_ms(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+/* server_cpu_ms - Read the CPU time another process has used so far
+ * return - Milliseconds of user and system time, or -1 if it can not be read on this platform
+ */
+static double server_cpu_ms(pid_t pid)
+{
+#if defined(__linux__)
+  char path[64], line[1024];
+  unsigned long long utime = 0, stime = 0;
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+  size_t len = fread(line, 1, sizeof(line) - 1, file);
+  fclose(file);
+  line[len] = 0;
+  
+  // The command name may hold spaces, so count fields from the closing parenthesis, utime and stime are the 12th and 13th after it
+  const char *fields = strrchr(line, ')');
+  if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) return -1;
+  return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+#elif defined(__APPLE__)
+  struct proc_taskinfo info;
+  mach_timebase_info_data_t timebase;
+  if (proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &info, sizeof(info)) != sizeof(info)) return -1;
+  mach_timebase_info(&timebase);
+  return (double)(info.pti_total_user + info.pti_total_system) * timebase.numer / timebase.denom / 1e6;
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+/* round_trip - Send one message and wait for all of it to come back
+ * return - 0 on success, -1 if the connection failed
+ */
+static int round_trip(int fd, const unsigned char *message, unsigned char *echo, int size)
+{
+  int sent = 0, received = 0;
+  while (sent < size) {
+    ssize_t len = send(fd, message + sent, size - sent, 0);
+    if (len <= 0) return -1;
+    sent += (int)len;
+  }
+  while (received < size) {
+    ssize_t len = recv(fd, echo + received, size - received, 0);
+    if (len <= 0) return -1;
+    received += (int)len;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <address> <port> [count] [size] [interval_us] [label] [server_pid]\n", argv[0]);
+    return 1;
+  }
+  
+  int count = argc > 3 ? atoi(argv[3]) : 10000;
+  int size = argc > 4 ? atoi(argv[4]) : 32;
+  int interval = argc > 5 ? atoi(argv[5]) : 1000;
+  const char *label = argc > 6 ? argv[6] : "-";
+  pid_t server = argc > 7 ? (pid_t)atoi(argv[7]) : 0;
+  if (count <= 0 || size <= 0 || size > MAX_SIZE || interval < 0) {
+    fprintf(stderr, "count and size must be positive, size at most %d\n", MAX_SIZE);
+    return 1;
+  }
+  
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(atoi(argv[2]));
+  if (inet_pton(AF_INET, argv[1], &address.sin_addr) != 1) {
+    fprintf(stderr, "invalid address %s\n", argv[1]);
+    return 1;
+  }
+  
+  int opt_val = 1;
+  int fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0 || connect(fd, (const struct sockaddr *)&address, sizeof(address)) < 0) { perror("connect"); return 1; }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val));
+  
+  unsigned char *message = malloc(size), *echo = malloc(size);
+  uint64_t *samples = malloc(sizeof(uint64_t) * count);
+  memset(message, 'x', size);
+  
+  struct timespec gap;
+  gap.tv_sec = interval / 1000000;
+  gap.tv_nsec = (long)(interval % 1000000) * 1000;
+  
+  // Let both ends settle before we start counting
+  int i;
+  for (i = 0; i < WARMUP; ++i) {
+    if (round_trip(fd, message, echo, size) < 0) { perror("warmup"); return 1; }
+  }
+  
+  double cpu_start = process_cpu_ms();
+  double server_start = server > 0 ? server_cpu_ms(server) : -1;
+  uint64_t start = now_ns(), sum = 0;
+  for (i = 0; i < count; ++i) {
+    if (interval > 0) nanosleep(&gap, NULL);
+    uint64_t sent = now_ns();
+    if (round_trip(fd, message, echo, size) < 0) { perror("round trip"); return 1; }
+    samples[i] = now_ns() - sent;
+    sum += samples[i];
+  }
+  double elapsed = (now_ns() - start) / 1e6;
+  double cpu = process_cpu_ms() - cpu_start;
+  double server_cpu = server_start >= 0 ? server_cpu_ms(server) - server_start : -1;
+  close(fd);
+  
+  qsort(samples, count, sizeof(uint64_t), compare_samples);
+  printf("%-16s %8s %8s %8s %8s %8s %8s %8s %10s %10s\n", "mode", "count", "mean", "p50", "p90", "p99", "p999", "max", "client_cpu", "server_cpu");
+  printf("%-16s %8d %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f%%", label, count, sum / 1000.0 / count,
+         percentile(samples, count, 50.0), percentile(samples, count, 90.0), percentile(samples, count, 99.0),
+         percentile(samples, count, 99.9), samples[count - 1] / 1000.0, elapsed > 0 ? cpu / elapsed * 100.0 : 0);
+  if (server_cpu >= 0 && elapsed > 0) printf(" %9.1f%%\n", server_cpu / elapsed * 100.0);
+  else printf(" %10s\n", "-");
+  
+  free(message);
+  free(echo);
+  free(samples);
+  return 0;
+}
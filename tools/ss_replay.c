@@ -0,0 +1,255 @@
+/*
+ Copyright (c) 2012 Justin Walsh, http://thejustinwalsh.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* ss_replay - Replay a ServerSocket capture file against a listener over loopback
+ *
+ * Build: cc -O2 -I platform/ios -o ss_replay tools/ss_replay.c
+ * Usage: ss_replay <capture> [address] [port] [speed]
+ *
+ * Every captured connection is re-opened against address:port and the bytes the clients sent are
+ * written back at their original pace, divided by speed. A speed of 0 replays as fast as possible.
+ * Without an address the capture is dumped to stdout instead.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ss_capture.h"
+
+#define MAX_CONNECTIONS 4096
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+  uint32_t connection;
+  int socket_fd;
+} replay_connection;
+
+static replay_connection connections[MAX_CONNECTIONS];
+static int num_connections = 0;
+
+static const char* type_names[] = { "pad", "accept", "close", "recv", "send" };
+
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static replay_connection* find_connection(uint32_t connection)
+{
+  int i;
+  for (i = 0; i < num_connections; ++i) {
+    if (connections[i].connection == connection) return &connections[i];
+  }
+  return NULL;
+}
+
+static void drop_connection(replay_connection *c)
+{
+  close(c->socket_fd);
+  *c = connections[--num_connections];
+}
+
+/* drain - Read and discard whatever the server has sent back so it never blocks on us
+ */
+static void drain(void)
+{
+  unsigned char scratch[4096];
+  int i;
+  for (i = 0; i < num_connections; ++i) {
+    while (recv(connections[i].socket_fd, scratch, sizeof(scratch), MSG_DONTWAIT) > 0);
+  }
+}
+
+static int open_connection(const struct sockaddr_in *address)
+{
+  int opt_val = 1;
+  int fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return -1;
+  
+  if (connect(fd, (const struct sockaddr *)address, sizeof(*address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  
+  // Captured chunks should hit the wire the moment we write them
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val));
+  return fd;
+}
+
+/* send_all - Write a captured chunk without blocking, draining responses whenever the server pushes back
+ * @return - 0 once the chunk is written, -1 if the connection failed
+ */
+static int send_all(replay_connection *c, const unsigned char *data, size_t size)
+{
+  while (size > 0) {
+    ssize_t len = send(c->socket_fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (len > 0) {
+      data = data + len;
+      size = size - (size_t)len;
+    }
+    else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      // The server is not reading until it can send its answers, so read them while we wait
+      struct pollfd pfd = { c->socket_fd, POLLOUT, 0 };
+      drain();
+      poll(&pfd, 1, 1);
+    }
+    else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void wait_until(uint64_t deadline)
+{
+  uint64_t now;
+  while ((now = now_ns()) < deadline) {
+    uint64_t delta = deadline - now;
+    struct timespec sleep_time;
+    
+    // Keep draining responses while we wait, in slices of at most 1ms
+    drain();
+    if (delta > 1000000) delta = 1000000;
+    sleep_time.tv_sec = 0;
+    sleep_time.tv_nsec = (long)delta;
+    nanosleep(&sleep_time, NULL);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <capture> [address] [port] [speed]\n", argv[0]);
+    return 1;
+  }
+  
+  // Map the capture file
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ss_capture_header)) {
+    fprintf(stderr, "unable to open capture %s\n", argv[1]);
+    return 1;
+  }
+  unsigned char *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { perror("mmap"); return 1; }
+  
+  const ss_capture_header *header = (const ss_capture_header *)map;
+  const unsigned char *ring = map + sizeof(ss_capture_header);
+  if (memcmp(header->magic, SS_CAPTURE_MAGIC, sizeof(header->magic)) != 0 || sizeof(ss_capture_header) + header->size > (uint64_t)st.st_size) {
+    fprintf(stderr, "%s is not a capture file\n", argv[1]);
+    return 1;
+  }
+  
+  // A server resetting a connection should only drop that connection
+  signal(SIGPIPE, SIG_IGN);
+  
+  // Without a target just describe the capture
+  bool dump = argc < 3;
+  struct sockaddr_in address;
+  double speed = argc > 4 ? atof(argv[4]) : 1.0;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(argc > 3 ? atoi(argv[3]) : 0);
+  if (!dump && inet_pton(AF_INET, argv[2], &address.sin_addr) != 1) {
+    fprintf(stderr, "invalid address %s\n", argv[2]);
+    return 1;
+  }
+  
+  fprintf(stderr, "%llu records, %llu dropped\n", (unsigned long long)header->records, (unsigned long long)header->dropped);
+  
+  uint64_t offset = header->tail, first_timestamp = 0, start = now_ns(), bytes = 0;
+  uint64_t i;
+  for (i = 0; i < header->records; ++i) {
+    // Follow the ring back to the start when we hit the end or the filler record
+    if (offset + sizeof(ss_capture_record) > header->size || ((const ss_capture_record *)&ring[offset])->type == SS_CAPTURE_PAD) offset = 0;
+    
+    const ss_capture_record *record = (const ss_capture_record *)&ring[offset];
+    const unsigned char *payload = &ring[offset + sizeof(ss_capture_record)];
+    offset = offset + SS_CAPTURE_ALIGN(sizeof(ss_capture_record) + record->size);
+    if (i == 0) first_timestamp = record->timestamp;
+    
+    if (dump) {
+      printf("%12.6f %-6s %6u %u\n", (record->timestamp - first_timestamp) / 1e9, record->type <= SS_CAPTURE_SEND ? type_names[record->type] : "?", record->connection, record->size);
+      continue;
+    }
+    
+    // Keep the original pacing, scaled by our speed
+    // Flat out there is no waiting to drain responses in, so do it between records
+    if (speed > 0) wait_until(start + (uint64_t)((record->timestamp - first_timestamp) / speed));
+    else drain();
+    
+    replay_connection *c = find_connection(record->connection);
+    switch (record->type) {
+      case SS_CAPTURE_ACCEPT:
+        if (c != NULL) drop_connection(c);
+        if (num_connections == MAX_CONNECTIONS) break;
+        connections[num_connections].connection = record->connection;
+        connections[num_connections].socket_fd = open_connection(&address);
+        if (connections[num_connections].socket_fd < 0) { perror("connect"); break; }
+        num_connections++;
+        break;
+      
+      case SS_CAPTURE_CLOSE:
+        if (c != NULL) drop_connection(c);
+        break;
+      
+      case SS_CAPTURE_RECV:
+        // Connections that were already open when the capture started are skipped
+        if (c == NULL) break;
+        if (send_all(c, payload, record->size) < 0) { perror("send"); drop_connection(c); break; }
+        bytes = bytes + record->size;
+        break;
+      
+      default:
+        break;
+    }
+  }
+  
+  if (!dump) {
+    double elapsed = (now_ns() - start) / 1e9;
+    fprintf(stderr, "replayed %llu bytes in %.3fs\n", (unsigned long long)bytes, elapsed);
+    while (num_connections > 0) drop_connection(&connections[0]);
+  }
+  
+  munmap(map, (size_t)st.st_size);
+  return 0;
+}